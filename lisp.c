@@ -1,401 +1,4999 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <time.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <sys/time.h>
+#define LISP_THREADS 1
+#define LISP_SAMPLING 1
+#else
+#include <io.h>
+#endif
+
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
+#ifdef LISP_THREADS
+#define LOCK(mutex) pthread_mutex_lock(&(mutex))
+#define UNLOCK(mutex) pthread_mutex_unlock(&(mutex))
+#define ATOMIC(type) _Atomic(type)
+#define LOAD_ACQUIRE(var) atomic_load_explicit(&(var), memory_order_acquire)
+#define STORE_RELEASE(var, value) atomic_store_explicit(&(var), value, memory_order_release)
+// Only instances other threads are running on need their table locks
+#define LOCK_SHARED(mutex) do { if (LOAD_ACQUIRE(interp->sharers)) LOCK(mutex); } while (0)
+#define UNLOCK_SHARED(mutex) do { if (LOAD_ACQUIRE(interp->sharers)) UNLOCK(mutex); } while (0)
+#else
+#define LOCK(mutex)
+#define UNLOCK(mutex)
+#define LOCK_SHARED(mutex)
+#define UNLOCK_SHARED(mutex)
+#define ATOMIC(type) type
+#define LOAD_ACQUIRE(var) (var)
+#define STORE_RELEASE(var, value) ((var) = (value))
+#endif
+
+// Inline cache for one global reference site. A binding once found is kept for
+// good, since bindings never move or go away; a name found unbound is remembered
+// with the environment version it was looked up in, which set() bumps whenever
+// it adds a binding.
+typedef struct GlobalCache {
+    struct SExpr* name;
+    ATOMIC(struct Env*) binding;
+    ATOMIC(size_t) version;     // CACHE_UNFILLED until the first miss
+} GlobalCache;
+
+#define CACHE_UNFILLED SIZE_MAX
 
 typedef struct SExpr {
-    enum { SYMBOL, NUMBER, CONS, NIL, ERROR, LAMBDA } type;
+    enum { SYMBOL, NUMBER, CONS, NIL, ERROR, LAMBDA, CODE, BIGNUM, FLOAT, VECTOR, FRAME, LOCAL, GLOBAL, FREE } type;
+    unsigned int mark;          // Collection epoch in which the cell was last reached
     union {
-        char* symbol;
-        int number;
+        struct {
+            char* symbol;
+            int opcode;         // Special form or builtin this symbol names (OP_NONE if ordinary)
+            unsigned int hash;
+        };
+        long long number;       // Boxed integers that don't fit in a fixnum
+        struct Chunk* chunk;    // CODE: compiled bytecode
+        double real;            // FLOAT
+        struct {                // VECTOR: malloc'd packed elements
+            double* elements;
+            int length;
+        };
+        struct {                // BIGNUM: malloc'd magnitude, least significant limb first
+            uint32_t* limbs;
+            int limbCount;
+            int negative;
+        };
         struct {
             struct SExpr* car;
             struct SExpr* cdr;
+        };
+        struct {
             struct SExpr* params;
             struct SExpr* body;
-            struct SExpr* env;
+            struct SExpr* env;  // Captured FRAME, nil at top level, NULL for an uncaptured template
+            int arity;
+            struct SExpr* lambdaName;   // Symbol it was first bound to by set, NULL if anonymous
+        };
+        struct {                // FRAME: one call's arguments, addressed by slot
+            struct SExpr* parent;
+            struct SExpr** slots;   // Only used when slotCount > FRAME_INLINE_SLOTS
+            int slotCount;
+            int captured;       // A closure holds on to this frame, so it can't be reused
+            struct SExpr* inlineSlots[2];
+        };
+        struct {                // LOCAL: a variable reference resolved when its lambda was made
+            struct SExpr* localName;
+            int depth;          // How many frames to walk up
+            int slot;
         };
+        GlobalCache global;     // GLOBAL: a reference to a global from inside a lambda body
     };
 } SExpr;
 
+#define FRAME_INLINE_SLOTS 2
+
+
+// Operators are recognised by the opcode stored on their interned symbol
+enum {
+    OP_NONE, OP_QUOTE, OP_SET, OP_EQ, OP_LAMBDA,
+    OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_AND, OP_OR, OP_IF, OP_COND,
+    OP_GT, OP_LT, OP_GE, OP_LE,
+    OP_VECTOR, OP_VADD, OP_VMUL, OP_DOT, OP_VSUM, OP_VMIN, OP_VMAX, OP_VMAP
+};
+
+// Intern table: every distinct name maps to exactly one SYMBOL SExpr
+typedef struct SymbolTable {
+    SExpr** slots;      // Open addressing, capacity is a power of two
+    size_t capacity;
+    size_t count;
+} SymbolTable;
+
+// Hash-consing table: the canonical cell for each distinct immutable cons or
+// boxed number, keyed by content. Weak: entries don't keep their cell alive.
+typedef struct ShareTable {
+    SExpr** slots;      // Open addressing, capacity is a power of two
+    size_t capacity;
+    size_t count;
+} ShareTable;
 
+
+// A single global binding. Cells never move once created; only the table slots pointing at them do
 typedef struct Env {
     SExpr* name;
-    SExpr* value;
-    struct Env* next;
+    ATOMIC(SExpr*) value;
 } Env;
 
-Env* global_env = NULL;
+typedef struct EnvSlots {
+    size_t capacity;        // A power of two, kept at most half full
+    struct EnvSlots* retired;   // The table this one replaced
+    ATOMIC(Env*) slots[];
+} EnvSlots;
+
+// Global environment: open-addressing hash map keyed by interned symbol. Reads
+// are wait-free: a reader loads the current table and probes it, and bindings
+// are never removed, so an empty slot always ends the search. Writers take the
+// lock and publish with release stores: a value in place, a new binding into an
+// empty slot, or a grown copy of the whole table. Replaced tables stay allocated
+// until the instance is destroyed, since a reader may still be probing one;
+// growth doubles, so they never add up to more than the live table.
+typedef struct EnvTable {
+    ATOMIC(EnvSlots*) table;
+    ATOMIC(size_t) version; // Bumped after every new binding, so cached misses go stale
+    size_t count;           // Writers only
+#ifdef LISP_THREADS
+    pthread_mutex_t writeLock;
+#endif
+} EnvTable;
+
+
+// Allocation layer: SExpr cells are handed out by bump-pointer arenas built from
+// large cache-aligned slabs. The current allocator can be swapped, which is how
+// top-level forms get a scratch arena that is reset in bulk once they finish.
+#define SLAB_BYTES (256 * 1024)
+#define CACHE_LINE 64
+
+typedef struct Slab {
+    struct Slab* next;
+    void* raw;          // What malloc returned; cells start at the first cache line boundary
+    char* cells;
+    char* limit;
+} Slab;
+
+typedef struct Arena {
+    Slab* first;
+    Slab* current;
+    char* next;         // Bump pointer into current
+    char* limit;
+    size_t allocated;   // Cells handed out since the last reset
+    size_t retired;     // Cells released by earlier resets
+    SExpr** owners;     // Cells holding malloc'd storage, released by the reset
+    size_t ownerCount, ownerCapacity;
+} Arena;
+
+typedef struct Allocator {
+    SExpr* (*alloc)(void* context);
+    void* context;
+} Allocator;
+
+typedef struct GCStats {
+    size_t collections;
+    size_t bytesAllocated;
+    size_t bytesReclaimed;
+    size_t bytesLive;           // After the last collection
+    long long lastPauseNs;
+    long long maxPauseNs;
+    long long totalPauseNs;
+} GCStats;
 
-SExpr* nil;
+// Garbage-collected heap: a mark-and-sweep collector over the slabs of an arena.
+// Swept cells go on a free list that is used before bumping into fresh slab space.
+typedef struct Heap {
+    Arena arena;
+    SExpr* freeList;            // Chained through car
+    uintptr_t low, high;        // Bounds of every slab, to reject non-heap words quickly
+    size_t allocatedSinceGC;
+    size_t threshold;           // Collect once this many bytes were allocated since the last collection
+    size_t minThreshold;        // Tunable: never collect more often than this
+    double growthFactor;        // Tunable: next threshold is bytesLive * growthFactor
+    int inhibit;                // Collections are deferred while non-zero
+    unsigned int epoch;
+    char* stackBase;            // Conservative stack scanning stops here
+    GCStats stats;
+} Heap;
+
+SExpr* arenaAlloc(void* context);
+SExpr* heapAlloc(void* context);
+
+// Everything one interpreter instance owns. The evaluator reaches its instance
+// through the thread-local interp, so instances on different threads share no
+// mutable state and need no locks; the embedding API below binds it per call.
+typedef struct Interp {
+    SymbolTable symbols;
+#ifdef LISP_THREADS
+    pthread_mutex_t symbolsLock;    // Held while sharers is non-zero; the batch reader interns too
+    ATOMIC(int) sharers;            // Threads started on this instance and not yet joined
+#endif
+    EnvTable globals;
+    Heap heap;
+    Arena scratchArena;
+    Allocator heapAllocator;
+    Allocator scratchAllocator;
+    Arena* sourceArena;         // Arena holding the forms being evaluated; promoted like scratch
+    SExpr** markStack;          // Collector work list
+    size_t markStackSize, markStackCapacity;
+    SExpr** forwardFrom;        // Promotion forwarding map
+    SExpr** forwardTo;
+    size_t forwardCapacity, forwardCount;
+    char* error;                // Message of the first error value made since it was last cleared (by lispEval)
+    int optimize;               // Run optimize() over top-level forms before evaluating or compiling them
+    size_t nodesEliminated;     // By the optimizer, over the life of the instance
+    int hashCons;               // Rebuild top-level forms from shared canonical cells
+    ShareTable shared;
+} Interp;
+
+#define HEAP_DEFAULTS { .low = UINTPTR_MAX, .threshold = 1 << 20, .minThreshold = 1 << 20, .growthFactor = 2.0 }
+
+// The instance the command line tools and tests run in
+Interp defaultInterp = {
+#ifdef LISP_THREADS
+    .symbolsLock = PTHREAD_MUTEX_INITIALIZER,
+    .globals = { .writeLock = PTHREAD_MUTEX_INITIALIZER },
+#endif
+    .heap = HEAP_DEFAULTS,
+    .heapAllocator = { heapAlloc, &defaultInterp.heap },
+    .scratchAllocator = { arenaAlloc, &defaultInterp.scratchArena },
+};
+THREAD_LOCAL Interp* interp = &defaultInterp;
+THREAD_LOCAL Allocator* allocator = &defaultInterp.heapAllocator;  // Per thread, so a reader thread can fill its own arena
+
+// nil and t are preallocated singletons; t is entered into the intern table by initSymbols()
+SExpr nilCell = { .type = NIL };
+SExpr trueCell = { .type = SYMBOL, .symbol = "t", .opcode = OP_NONE, .hash = 0xf10c3da3u };  // hashName("t")
+SExpr* nil = &nilCell;
+SExpr* truth = &trueCell;
+THREAD_LOCAL SExpr* currentFrame = NULL;  // Frame of the function being evaluated, NULL at top level
+#ifdef LISP_THREADS
+THREAD_LOCAL struct Worker* currentWorker = NULL;   // Set while evaluating on behalf of the parallel scheduler
+void workerEscape(int reason);
+void workerCheckpoint();
+#endif
 SExpr* makeSymbol(char* name);
-SExpr* makeNumber(int value);
+SExpr* makeNumber(long long value);
 SExpr* cons(SExpr* car, SExpr* cdr);
 SExpr* eval(SExpr* expr);
 SExpr* makeError(char* message);  // Declaration of makeError function
 
-// Helper to compare two SExprs for equality
-int isTruthy(SExpr* expr) {
-    return expr != nil && (expr->type != NIL && (expr->type != NUMBER || expr->number != 0));
+// Small integers live in the pointer itself as (value << 1) | 1. Cells are at
+// least 8-byte aligned, so a set low bit never names a real SExpr and
+// arithmetic on fixnums never touches the heap. Always go through typeOf()
+// and numberOf() for values that may be numbers.
+#define FIXNUM_MAX (INTPTR_MAX >> 1)
+#define FIXNUM_MIN (INTPTR_MIN >> 1)
+
+int isFixnum(SExpr* expr) {
+    return ((uintptr_t)expr & 1) != 0;
+}
+
+SExpr* makeFixnum(intptr_t value) {
+    return (SExpr*)(((uintptr_t)value << 1) | 1);
+}
+
+int typeOf(SExpr* expr) {
+    return isFixnum(expr) ? NUMBER : (int)expr->type;
+}
+
+long long numberOf(SExpr* expr) {
+    return isFixnum(expr) ? (long long)((intptr_t)expr >> 1) : expr->number;
+}
+
+// Helper to compare two SExprs for equality
+int isTruthy(SExpr* expr) {
+    return expr != nil && (typeOf(expr) != NIL && (typeOf(expr) != NUMBER || numberOf(expr) != 0) &&
+        (typeOf(expr) != FLOAT || expr->real != 0));
+}
+
+// Moves the arena onto its next slab, reusing slabs kept from before a reset
+void arenaNextSlab(Arena* arena) {
+    Slab* slab = arena->current ? arena->current->next : arena->first;
+    if (!slab) {
+        slab = malloc(sizeof(Slab));
+        void* raw = slab ? malloc(SLAB_BYTES + CACHE_LINE) : NULL;
+        if (!raw) {
+            printf("Memory allocation failed for arena slab\n");
+            exit(1);
+        }
+        slab->next = NULL;
+        slab->raw = raw;
+        slab->cells = (char*)(((uintptr_t)raw + CACHE_LINE - 1) & ~(uintptr_t)(CACHE_LINE - 1));
+        slab->limit = slab->cells + (SLAB_BYTES / sizeof(SExpr)) * sizeof(SExpr);
+        if (arena->current) arena->current->next = slab;
+        else arena->first = slab;
+    }
+    arena->current = slab;
+    arena->next = slab->cells;
+    arena->limit = slab->limit;
+}
+
+SExpr* arenaAlloc(void* context) {
+    Arena* arena = (Arena*)context;
+    if (arena->next == arena->limit) arenaNextSlab(arena);
+    SExpr* cell = (SExpr*)arena->next;
+    arena->next += sizeof(SExpr);
+    arena->allocated++;
+    return cell;
+}
+
+void releaseExternal(SExpr* cell);
+
+// Releases every cell in the arena at once; the slabs are kept for reuse
+void arenaReset(Arena* arena) {
+    for (size_t i = 0; i < arena->ownerCount; i++) releaseExternal(arena->owners[i]);
+    arena->ownerCount = 0;
+    arena->current = NULL;
+    arena->next = arena->limit = NULL;
+    arena->retired += arena->allocated;
+    arena->allocated = 0;
+}
+
+// Remembers a cell whose malloc'd storage must be released when the arena is reset
+void arenaTrack(Arena* arena, SExpr* cell) {
+    if (arena->ownerCount == arena->ownerCapacity) {
+        arena->ownerCapacity = arena->ownerCapacity ? arena->ownerCapacity * 2 : 64;
+        arena->owners = realloc(arena->owners, arena->ownerCapacity * sizeof(SExpr*));
+        if (!arena->owners) {
+            printf("Memory allocation failed for arena owners\n");
+            exit(1);
+        }
+    }
+    arena->owners[arena->ownerCount++] = cell;
+}
+
+// Returns an arena's slabs to the system; the arena must not be used afterwards
+void arenaFree(Arena* arena) {
+    arenaReset(arena);
+    Slab* slab = arena->first;
+    while (slab) {
+        Slab* next = slab->next;
+        free(slab->raw);
+        free(slab);
+        slab = next;
+    }
+    free(arena->owners);
+    arena->first = NULL;
+    arena->owners = NULL;
+    arena->ownerCapacity = 0;
+}
+
+int arenaContains(Arena* arena, SExpr* expr) {
+    for (Slab* slab = arena->first; slab; slab = slab->next) {
+        if ((char*)expr >= slab->cells && (char*)expr < slab->limit) return 1;
+    }
+    return 0;
+}
+
+long long nowNanos() {
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Must be called from a frame that outlives every use of the interpreter, normally main()
+void initGC(void* stackBase) {
+    interp->heap.stackBase = (char*)stackBase;
+}
+
+void markCell(SExpr* expr) {
+    // nil and t are static and shared between instances, so never written
+    if (expr == NULL || isFixnum(expr) || expr == nil || expr == truth || expr->mark == interp->heap.epoch) return;
+    expr->mark = interp->heap.epoch;
+    if (expr->type != CONS && expr->type != LAMBDA && expr->type != CODE && expr->type != FRAME) return;
+    if (interp->markStackSize == interp->markStackCapacity) {
+        interp->markStackCapacity = interp->markStackCapacity ? interp->markStackCapacity * 2 : 1024;
+        interp->markStack = realloc(interp->markStack, interp->markStackCapacity * sizeof(SExpr*));
+        if (!interp->markStack) {
+            printf("Memory allocation failed for GC mark stack\n");
+            exit(1);
+        }
+    }
+    interp->markStack[interp->markStackSize++] = expr;
+}
+
+void markConstants(struct Chunk* chunk);
+void freeChunk(struct Chunk* chunk);
+void pruneShared();
+
+SExpr** frameSlots(SExpr* frame) {
+    return frame->slotCount <= FRAME_INLINE_SLOTS ? frame->inlineSlots : frame->slots;
+}
+
+// Frees whatever a dead cell owns outside the heap
+void releaseExternal(SExpr* cell) {
+    if (cell->type == CODE) freeChunk(cell->chunk);
+    else if (cell->type == BIGNUM) free(cell->limbs);
+    else if (cell->type == VECTOR) free(cell->elements);
+    else if (cell->type == FRAME && cell->slotCount > FRAME_INLINE_SLOTS) free(cell->slots);
+}
+
+void drainMarkStack() {
+    while (interp->markStackSize > 0) {
+        SExpr* expr = interp->markStack[--interp->markStackSize];
+        if (expr->type == CONS) {
+            markCell(expr->car);
+            markCell(expr->cdr);
+        } else if (expr->type == CODE) {
+            markConstants(expr->chunk);
+        } else if (expr->type == FRAME) {
+            markCell(expr->parent);
+            SExpr** slots = frameSlots(expr);
+            for (int i = 0; i < expr->slotCount; i++) markCell(slots[i]);
+        } else {
+            markCell(expr->params);
+            markCell(expr->body);
+            markCell(expr->env);
+        }
+    }
+}
+
+// Maps an arbitrary word to the live heap cell it points into, if any
+SExpr* heapCellAt(uintptr_t word) {
+    if (word < interp->heap.low || word >= interp->heap.high) return NULL;
+    for (Slab* slab = interp->heap.arena.first; slab; slab = slab->next) {
+        char* end = slab == interp->heap.arena.current ? interp->heap.arena.next : slab->limit;
+        if (word < (uintptr_t)slab->cells || word >= (uintptr_t)end) continue;
+        SExpr* cell = (SExpr*)(slab->cells + (word - (uintptr_t)slab->cells) / sizeof(SExpr) * sizeof(SExpr));
+        return cell->type == FREE ? NULL : cell;
+    }
+    return NULL;
+}
+
+// The evaluator's live values are whatever the C stack and registers hold, so scan them conservatively
+#if defined(__GNUC__)
+__attribute__((no_sanitize_address))
+#endif
+void scanStack() {
+    jmp_buf registers;
+    setjmp(registers);  // Spills callee-saved registers into this frame
+    char* top = (char*)&registers;
+    char* low = top < interp->heap.stackBase ? top : interp->heap.stackBase;
+    char* high = top < interp->heap.stackBase ? interp->heap.stackBase : top;
+    low = (char*)(((uintptr_t)low + sizeof(void*) - 1) & ~(uintptr_t)(sizeof(void*) - 1));
+    for (char* p = low; p + sizeof(void*) <= high; p += sizeof(void*)) {
+        uintptr_t word;
+        memcpy(&word, p, sizeof(word));
+        SExpr* cell = heapCellAt(word);
+        if (cell) markCell(cell);
+    }
+}
+
+void gcCollect() {
+    if (interp->heap.inhibit || interp->heap.stackBase == NULL) return;
+    long long start = nowNanos();
+    interp->heap.epoch++;
+
+    // Roots: nil, every global binding, the current frame and the evaluator's stack
+    markCell(currentFrame);
+    EnvSlots* globals = LOAD_ACQUIRE(interp->globals.table);
+    for (size_t i = 0; globals && i < globals->capacity; i++) {
+        Env* binding = LOAD_ACQUIRE(globals->slots[i]);
+        if (binding) markCell(LOAD_ACQUIRE(binding->value));
+    }
+    drainMarkStack();
+    scanStack();
+    drainMarkStack();
+    pruneShared();
+
+    size_t reclaimed = 0, live = 0;
+    for (Slab* slab = interp->heap.arena.first; slab; slab = slab->next) {
+        char* end = slab == interp->heap.arena.current ? interp->heap.arena.next : slab->limit;
+        for (char* p = slab->cells; p < end; p += sizeof(SExpr)) {
+            SExpr* cell = (SExpr*)p;
+            if (cell->type == FREE) continue;
+            if (cell->mark == interp->heap.epoch) {
+                live += sizeof(SExpr);
+                continue;
+            }
+            releaseExternal(cell);
+            cell->type = FREE;
+            cell->car = interp->heap.freeList;
+            interp->heap.freeList = cell;
+            reclaimed += sizeof(SExpr);
+        }
+        if (slab == interp->heap.arena.current) break;
+    }
+
+    double next = live * interp->heap.growthFactor;
+    interp->heap.threshold = next > interp->heap.minThreshold ? (size_t)next : interp->heap.minThreshold;
+    interp->heap.allocatedSinceGC = 0;
+
+    long long pause = nowNanos() - start;
+    interp->heap.stats.collections++;
+    interp->heap.stats.bytesReclaimed += reclaimed;
+    interp->heap.stats.bytesLive = live;
+    interp->heap.stats.lastPauseNs = pause;
+    interp->heap.stats.totalPauseNs += pause;
+    if (pause > interp->heap.stats.maxPauseNs) interp->heap.stats.maxPauseNs = pause;
+}
+
+SExpr* heapAlloc(void* context) {
+    Heap* h = (Heap*)context;
+    if (h->allocatedSinceGC >= h->threshold) gcCollect();
+    h->allocatedSinceGC += sizeof(SExpr);
+    h->stats.bytesAllocated += sizeof(SExpr);
+    SExpr* cell = h->freeList;
+    if (cell) {
+        h->freeList = cell->car;
+    } else {
+        cell = arenaAlloc(&h->arena);
+        if ((uintptr_t)cell < h->low) h->low = (uintptr_t)cell;
+        if ((uintptr_t)(cell + 1) > h->high) h->high = (uintptr_t)(cell + 1);
+    }
+    cell->mark = 0;
+    return cell;
+}
+
+void printGCStats(FILE* out) {
+    fprintf(out, "collections: %zu\n", interp->heap.stats.collections);
+    fprintf(out, "bytes allocated: %zu\n", interp->heap.stats.bytesAllocated);
+    fprintf(out, "bytes reclaimed: %zu\n", interp->heap.stats.bytesReclaimed);
+    fprintf(out, "bytes live: %zu\n", interp->heap.stats.bytesLive);
+    fprintf(out, "pause ns (last/max/total): %lld/%lld/%lld\n",
+        interp->heap.stats.lastPauseNs, interp->heap.stats.maxPauseNs, interp->heap.stats.totalPauseNs);
+}
+
+// Evaluation profile. Built with -DLISP_PROFILE, eval() counts every special
+// form, builtin, global lookup and closure call with the time and cells spent
+// inside it. Times are inclusive of nested evaluation, except that a form which
+// continues in tail position (if, cond, and, or, a closure call) stops its clock
+// at the jump, so a closure call covers its arguments and the body is charged to
+// the forms in it. Without the flag the profiler and its hooks compile away entirely.
+#ifdef LISP_PROFILE
+enum { PROFILE_GET = OP_VMAP + 1, PROFILE_CALL, PROFILE_SLOTS };
+#define PROFILE_BUCKETS 40      // Bucket b counts calls taking under 2^(b+1) ns
+
+typedef struct ProfileEntry {
+    long long calls;
+    long long totalNs;
+    long long cells;
+    long long histogram[PROFILE_BUCKETS];
+} ProfileEntry;
+
+// One table per thread, so recording never contends; reports sum them all
+typedef struct Profile {
+    ProfileEntry entries[PROFILE_SLOTS];
+    struct Profile* next;
+} Profile;
+
+const char* profileNames[PROFILE_SLOTS] = {
+    "(other)", "quote", "set", "eq", "lambda", "add", "sub", "mul", "div", "and", "or", "if", "cond",
+    ">", "<", ">=", "<=", "vector", "vadd", "vmul", "dot", "vsum", "vmin", "vmax", "vmap",
+    "global lookup", "closure call"
+};
+
+Profile* profiles;
+#ifdef LISP_THREADS
+pthread_mutex_t profilesLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+THREAD_LOCAL Profile* threadProfile;
+
+Profile* profileTable() {
+    if (!threadProfile) {
+        threadProfile = calloc(1, sizeof(Profile));
+        if (!threadProfile) {
+            printf("Memory allocation failed for profile\n");
+            exit(1);
+        }
+        LOCK(profilesLock);
+        threadProfile->next = profiles;
+        profiles = threadProfile;
+        UNLOCK(profilesLock);
+    }
+    return threadProfile;
+}
+
+void profileRecord(int slot, long long elapsedNs, long long cells) {
+    ProfileEntry* entry = &profileTable()->entries[slot];
+    int bucket = 0;
+    while (bucket < PROFILE_BUCKETS - 1 && elapsedNs >= 2LL << bucket) bucket++;
+    entry->calls++;
+    entry->totalNs += elapsedNs;
+    entry->cells += cells;
+    entry->histogram[bucket]++;
+}
+
+// Clears every thread's counts
+void profileReset() {
+    LOCK(profilesLock);
+    for (Profile* p = profiles; p; p = p->next) memset(p->entries, 0, sizeof(p->entries));
+    UNLOCK(profilesLock);
+}
+
+// Upper bound in ns of the bucket holding the given fraction of calls
+long long profilePercentile(ProfileEntry* entry, double fraction) {
+    long long rank = (long long)(fraction * entry->calls + 0.999999), seen = 0;
+    for (int b = 0; b < PROFILE_BUCKETS; b++) {
+        seen += entry->histogram[b];
+        if (seen >= rank) return 2LL << b;
+    }
+    return 2LL << (PROFILE_BUCKETS - 1);
+}
+
+int compareProfileTotals(const void* a, const void* b) {
+    long long x = ((const ProfileEntry*)a)->totalNs, y = ((const ProfileEntry*)b)->totalNs;
+    return (x < y) - (x > y);
+}
+
+// Writes the summed profile, most expensive first, as an aligned table or as JSON
+void writeProfile(FILE* out, int json) {
+    struct { ProfileEntry entry; const char* name; } rows[PROFILE_SLOTS];
+    memset(rows, 0, sizeof(rows));
+    LOCK(profilesLock);
+    for (int s = 0; s < PROFILE_SLOTS; s++) {
+        rows[s].name = profileNames[s];
+        for (Profile* p = profiles; p; p = p->next) {
+            ProfileEntry* e = &p->entries[s];
+            rows[s].entry.calls += e->calls;
+            rows[s].entry.totalNs += e->totalNs;
+            rows[s].entry.cells += e->cells;
+            for (int b = 0; b < PROFILE_BUCKETS; b++) rows[s].entry.histogram[b] += e->histogram[b];
+        }
+    }
+    UNLOCK(profilesLock);
+    qsort(rows, PROFILE_SLOTS, sizeof(rows[0]), compareProfileTotals);   // The entry is the first member
+    if (json) fprintf(out, "{\"profile\": [");
+    else fprintf(out, "%-14s %12s %12s %10s %10s %10s %10s\n", "form", "calls", "total ms", "mean ns", "p50 ns <", "p99 ns <", "cells/call");
+    int first = 1;
+    for (int s = 0; s < PROFILE_SLOTS; s++) {
+        ProfileEntry* e = &rows[s].entry;
+        if (!e->calls) continue;
+        if (json) {
+            int last = PROFILE_BUCKETS - 1;
+            while (last > 0 && !e->histogram[last]) last--;
+            fprintf(out, "%s\n  {\"name\": \"%s\", \"calls\": %lld, \"total_ns\": %lld, \"mean_ns\": %.1f, "
+                "\"p50_ns\": %lld, \"p99_ns\": %lld, \"cells\": %lld, \"histogram_log2_ns\": [",
+                first ? "" : ",", rows[s].name, e->calls, e->totalNs, (double)e->totalNs / e->calls,
+                profilePercentile(e, 0.5), profilePercentile(e, 0.99), e->cells);
+            for (int b = 0; b <= last; b++) fprintf(out, b ? ", %lld" : "%lld", e->histogram[b]);
+            fprintf(out, "]}");
+        } else {
+            fprintf(out, "%-14s %12lld %12.3f %10.1f %10lld %10lld %10.2f\n", rows[s].name, e->calls, e->totalNs / 1e6,
+                (double)e->totalNs / e->calls, profilePercentile(e, 0.5), profilePercentile(e, 0.99), (double)e->cells / e->calls);
+        }
+        first = 0;
+    }
+    if (json) fprintf(out, "\n]}\n");
+    fflush(out);
+}
+
+THREAD_LOCAL long long profileCells;
+#define PROFILE_BEGIN() long long profileStart = nowNanos(), profileCellsStart = profileCells
+#define PROFILE_END(slot) profileRecord(slot, nowNanos() - profileStart, profileCells - profileCellsStart)
+
+// Report at exit: a table on stderr, or JSON to the file named by LISP_PROFILE_JSON
+void writeProfileAtExit() {
+    char* path = getenv("LISP_PROFILE_JSON");
+    FILE* out = path ? fopen(path, "w") : NULL;
+    writeProfile(out ? out : stderr, out != NULL);
+    if (out) fclose(out);
+}
+#else
+#define PROFILE_BEGIN()
+#define PROFILE_END(slot)
+#endif
+
+SExpr* allocSExpr() {
+#ifdef LISP_PROFILE
+    profileCells++;
+#endif
+    // Call the allocator directly when we can so the fast path can be inlined
+    if (allocator->alloc == heapAlloc) return heapAlloc(allocator->context);
+    if (allocator->alloc == arenaAlloc) return arenaAlloc(allocator->context);
+    return allocator->alloc(allocator->context);
+}
+
+// Records a cell with malloc'd storage so that an arena reset releases it
+void trackExternal(SExpr* cell) {
+    if (allocator->alloc == arenaAlloc) arenaTrack((Arena*)allocator->context, cell);
+}
+
+// Copies anything still living in the scratch arena onto the collected heap.
+// Collection is held off meanwhile because the source cells aren't roots. A
+// forwarding map keeps shared structure shared and lets closure/frame cycles terminate.
+
+SExpr* forwarded(SExpr* expr) {
+    if (interp->forwardCount == 0) return NULL;
+    size_t i = ((uintptr_t)expr / sizeof(SExpr)) & (interp->forwardCapacity - 1);
+    while (interp->forwardFrom[i]) {
+        if (interp->forwardFrom[i] == expr) return interp->forwardTo[i];
+        i = (i + 1) & (interp->forwardCapacity - 1);
+    }
+    return NULL;
+}
+
+void forward(SExpr* from, SExpr* to) {
+    if ((interp->forwardCount + 1) * 2 > interp->forwardCapacity) {
+        size_t oldCapacity = interp->forwardCapacity;
+        SExpr** oldFrom = interp->forwardFrom;
+        SExpr** oldTo = interp->forwardTo;
+        interp->forwardCapacity = interp->forwardCapacity ? interp->forwardCapacity * 2 : 256;
+        interp->forwardFrom = calloc(interp->forwardCapacity, sizeof(SExpr*));
+        interp->forwardTo = calloc(interp->forwardCapacity, sizeof(SExpr*));
+        if (!interp->forwardFrom || !interp->forwardTo) {
+            printf("Memory allocation failed for promotion\n");
+            exit(1);
+        }
+        interp->forwardCount = 0;
+        for (size_t i = 0; i < oldCapacity; i++) {
+            if (oldFrom[i]) forward(oldFrom[i], oldTo[i]);
+        }
+        free(oldFrom);
+        free(oldTo);
+    }
+    size_t i = ((uintptr_t)from / sizeof(SExpr)) & (interp->forwardCapacity - 1);
+    while (interp->forwardFrom[i]) i = (i + 1) & (interp->forwardCapacity - 1);
+    interp->forwardFrom[i] = from;
+    interp->forwardTo[i] = to;
+    interp->forwardCount++;
+}
+
+SExpr* promoteCell(SExpr* expr);
+int isTransient(SExpr* expr);
+
+SExpr* promote(SExpr* expr) {
+    if (!isTransient(expr)) return expr;    // Nothing to copy, and nothing shared touched
+    interp->heap.inhibit++;
+    SExpr* result = promoteCell(expr);
+    if (interp->forwardCount) {
+        memset(interp->forwardFrom, 0, interp->forwardCapacity * sizeof(SExpr*));
+        interp->forwardCount = 0;
+    }
+    interp->heap.inhibit--;
+    return result;
+}
+
+// Cells that will be released in bulk and so must be copied before the heap keeps them
+int isTransient(SExpr* expr) {
+    return expr != NULL && !isFixnum(expr) &&
+        (arenaContains(&interp->scratchArena, expr) || (interp->sourceArena && arenaContains(interp->sourceArena, expr)));
+}
+
+int isScratch(SExpr* expr) {
+    return isTransient(expr) && !forwarded(expr);
+}
+
+SExpr* promoteCell(SExpr* expr) {
+    if (!isTransient(expr)) return expr;
+    SExpr* copy = forwarded(expr);
+    if (copy) return copy;
+    copy = heapAlloc(&interp->heap);
+    *copy = *expr;
+    forward(expr, copy);
+    if (expr->type == LAMBDA) {
+        copy->params = promoteCell(expr->params);
+        copy->body = promoteCell(expr->body);
+        copy->env = promoteCell(expr->env);
+    } else if (expr->type == FRAME) {
+        if (expr->slotCount > FRAME_INLINE_SLOTS) {
+            copy->slots = malloc(expr->slotCount * sizeof(SExpr*));
+            if (!copy->slots) {
+                printf("Memory allocation failed for frame\n");
+                exit(1);
+            }
+        }
+        SExpr** from = frameSlots(expr);
+        SExpr** to = frameSlots(copy);
+        for (int i = 0; i < expr->slotCount; i++) to[i] = promoteCell(from[i]);
+        copy->parent = promoteCell(expr->parent);
+    } else if (expr->type == BIGNUM) {
+        copy->limbs = malloc(expr->limbCount * sizeof(uint32_t) + 1);
+        if (!copy->limbs) {
+            printf("Memory allocation failed for bignum\n");
+            exit(1);
+        }
+        memcpy(copy->limbs, expr->limbs, expr->limbCount * sizeof(uint32_t));
+    } else if (expr->type == VECTOR) {
+        copy->elements = malloc(expr->length * sizeof(double) + 1);
+        if (!copy->elements) {
+            printf("Memory allocation failed for vector\n");
+            exit(1);
+        }
+        memcpy(copy->elements, expr->elements, expr->length * sizeof(double));
+    } else if (expr->type == LOCAL) {
+        copy->localName = promoteCell(expr->localName);
+    } else if (expr->type == CONS) {
+        // Walk the spine iteratively so long lists don't recurse on cdr
+        SExpr* tail = copy;
+        tail->car = promoteCell(expr->car);
+        while (typeOf(tail->cdr) == CONS && isScratch(tail->cdr)) {
+            SExpr* next = heapAlloc(&interp->heap);
+            *next = *tail->cdr;
+            forward(tail->cdr, next);
+            next->car = promoteCell(next->car);
+            tail->cdr = next;
+            tail = next;
+        }
+        tail->cdr = promoteCell(tail->cdr);
+    }
+    return copy;
+}
+
+// FNV-1a
+unsigned int hashSpan(const char* name, size_t length) {
+    unsigned int h = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        h ^= (unsigned char)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+unsigned int hashName(const char* name) {
+    return hashSpan(name, strlen(name));
+}
+
+void growSymbols() {
+    size_t capacity = interp->symbols.capacity ? interp->symbols.capacity * 2 : 256;
+    SExpr** slots = calloc(capacity, sizeof(SExpr*));
+    if (!slots) {
+        printf("Memory allocation failed for symbol table\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < interp->symbols.capacity; i++) {
+        SExpr* s = interp->symbols.slots[i];
+        if (!s) continue;
+        size_t j = s->hash & (capacity - 1);
+        while (slots[j]) j = (j + 1) & (capacity - 1);
+        slots[j] = s;
+    }
+    free(interp->symbols.slots);
+    interp->symbols.slots = slots;
+    interp->symbols.capacity = capacity;
+}
+
+void insertSymbol(SExpr* s) {
+    if (interp->symbols.count * 2 >= interp->symbols.capacity) growSymbols();
+    size_t i = s->hash & (interp->symbols.capacity - 1);
+    while (interp->symbols.slots[i]) i = (i + 1) & (interp->symbols.capacity - 1);
+    interp->symbols.slots[i] = s;
+    interp->symbols.count++;
+}
+
+// Looks a name up by span so callers (like the reader) needn't NUL-terminate a copy.
+// The table only copies a name the first time it is seen.
+SExpr* internSpan(const char* name, size_t length, int opcode) {
+    unsigned int hash = hashSpan(name, length);
+    LOCK_SHARED(interp->symbolsLock);
+    if (interp->symbols.capacity) {
+        size_t i = hash & (interp->symbols.capacity - 1);
+        while (interp->symbols.slots[i]) {
+            SExpr* s = interp->symbols.slots[i];
+            if (s->hash == hash && strncmp(s->symbol, name, length) == 0 && s->symbol[length] == '\0') {
+                UNLOCK_SHARED(interp->symbolsLock);
+                return s;
+            }
+            i = (i + 1) & (interp->symbols.capacity - 1);
+        }
+    }
+    SExpr* s = (SExpr*)malloc(sizeof(SExpr));
+    char* copy = s ? malloc(length + 1) : NULL;
+    if (!copy) {
+        printf("Memory allocation failed for symbol\n");
+        exit(1);
+    }
+    memcpy(copy, name, length);
+    copy[length] = '\0';
+    s->type = SYMBOL;
+    s->symbol = copy;
+    s->opcode = opcode;
+    s->hash = hash;
+    insertSymbol(s);
+    UNLOCK_SHARED(interp->symbolsLock);
+    return s;
+}
+
+SExpr* intern(char* name, int opcode) {
+    return internSpan(name, strlen(name), opcode);
+}
+
+void initSymbols() {
+    if (interp->symbols.count) return;
+    insertSymbol(truth);    // Shared by every instance, like nil
+    static const struct { char* name; int opcode; } operators[] = {
+        { "quote", OP_QUOTE }, { "set", OP_SET }, { "eq", OP_EQ }, { "lambda", OP_LAMBDA },
+        { "add", OP_ADD }, { "sub", OP_SUB }, { "mul", OP_MUL }, { "div", OP_DIV },
+        { "and", OP_AND }, { "or", OP_OR }, { "if", OP_IF }, { "cond", OP_COND },
+        { ">", OP_GT }, { "<", OP_LT }, { ">=", OP_GE }, { "<=", OP_LE },
+        { "vector", OP_VECTOR }, { "vadd", OP_VADD }, { "vmul", OP_VMUL }, { "dot", OP_DOT },
+        { "vsum", OP_VSUM }, { "vmin", OP_VMIN }, { "vmax", OP_VMAX }, { "vmap", OP_VMAP },
+    };
+    for (size_t i = 0; i < sizeof(operators) / sizeof(operators[0]); i++) {
+        intern(operators[i].name, operators[i].opcode);
+    }
+}
+
+// Returns the canonical symbol for name, so symbols can be compared by pointer
+SExpr* makeSymbol(char* name) {
+    if (interp->symbols.capacity == 0) initSymbols();
+    return intern(name, OP_NONE);
+}
+
+SExpr* makeSymbolSpan(const char* name, size_t length) {
+    if (interp->symbols.capacity == 0) initSymbols();
+    return internSpan(name, length, OP_NONE);
+}
+
+SExpr* makeNumber(long long value) {
+    if (value >= FIXNUM_MIN && value <= FIXNUM_MAX) return makeFixnum((intptr_t)value);
+    SExpr* n = allocSExpr();
+    n->type = NUMBER;
+    n->number = value;
+    return n;
+}
+
+SExpr* cons(SExpr* car, SExpr* cdr) {
+    SExpr* c = allocSExpr();
+    if (!c) {
+        printf("Memory allocation failed for cons\n");
+        exit(1);  // Handle memory allocation failure gracefully
+    }
+    c->type = CONS;
+    c->car = car;
+    c->cdr = cdr;
+    return c;
+}
+
+
+// The `makeError` function now returns an SExpr* to correctly handle errors
+// Error messages are deliberately not interned
+SExpr* makeError(char* message) {
+    // Parallel workers share the instance; their results are only printed
+#ifdef LISP_THREADS
+    if (!currentWorker && !interp->error) interp->error = message;
+#else
+    if (!interp->error) interp->error = message;
+#endif
+    SExpr* e = allocSExpr();
+    e->type = SYMBOL;
+    e->symbol = message;
+    e->opcode = OP_NONE;
+    e->hash = 0;
+    return e;
+}
+
+// Hash-consing: with interp->hashCons set, each top-level form, and with it
+// every quoted datum, is rebuilt bottom-up from canonical heap cells, so equal
+// subtrees and equal boxed numbers are one cell and eq on them compares
+// pointers. A cons is looked up by the identity of its already canonical car
+// and cdr. Nothing writes to a cons once it is built, so sharing is safe. The
+// collector drops entries whose cell died rather than marking through the table.
+unsigned int shareHash(SExpr* cell) {
+    uint64_t h;
+    if (cell->type == CONS) h = (uint64_t)(uintptr_t)cell->car * 0x9e3779b97f4a7c15ULL ^ (uint64_t)(uintptr_t)cell->cdr;
+    else if (cell->type == NUMBER) h = (uint64_t)cell->number;
+    else if (cell->type == FLOAT) memcpy(&h, &cell->real, sizeof(h));
+    else h = hashSpan((const char*)cell->limbs, cell->limbCount * sizeof(uint32_t)) ^ (uint64_t)cell->negative;
+    h ^= h >> 31;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 29;
+    return (unsigned int)h ^ (unsigned int)cell->type;
+}
+
+int sameContent(SExpr* a, SExpr* b) {
+    if (a->type != b->type) return 0;
+    if (a->type == CONS) return a->car == b->car && a->cdr == b->cdr;
+    if (a->type == NUMBER) return a->number == b->number;
+    if (a->type == FLOAT) return memcmp(&a->real, &b->real, sizeof(double)) == 0;   // Keeps -0.0 and 0.0 apart
+    return a->negative == b->negative && a->limbCount == b->limbCount &&
+        memcmp(a->limbs, b->limbs, a->limbCount * sizeof(uint32_t)) == 0;
+}
+
+// Rehashes into a table of the given capacity, keeping only cells the last collection reached if liveOnly
+void rebuildShared(size_t capacity, int liveOnly) {
+    SExpr** slots = calloc(capacity, sizeof(SExpr*));
+    if (!slots) {
+        printf("Memory allocation failed for share table\n");
+        exit(1);
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < interp->shared.capacity; i++) {
+        SExpr* cell = interp->shared.slots[i];
+        if (!cell || (liveOnly && cell->mark != interp->heap.epoch)) continue;
+        size_t j = shareHash(cell) & (capacity - 1);
+        while (slots[j]) j = (j + 1) & (capacity - 1);
+        slots[j] = cell;
+        count++;
+    }
+    free(interp->shared.slots);
+    interp->shared.slots = slots;
+    interp->shared.capacity = capacity;
+    interp->shared.count = count;
+}
+
+// Called by the collector between marking and sweeping
+void pruneShared() {
+    if (interp->shared.count) rebuildShared(interp->shared.capacity, 1);
+}
+
+// Returns the canonical cell with key's content, or NULL and the slot to enter it in
+SExpr* findShared(SExpr* key, size_t* slot) {
+    if ((interp->shared.count + 1) * 2 > interp->shared.capacity) {
+        rebuildShared(interp->shared.capacity ? interp->shared.capacity * 2 : 1024, 0);
+    }
+    size_t mask = interp->shared.capacity - 1;
+    size_t i = shareHash(key) & mask;
+    for (; interp->shared.slots[i]; i = (i + 1) & mask) {
+        if (sameContent(interp->shared.slots[i], key)) return interp->shared.slots[i];
+    }
+    *slot = i;
+    return NULL;
+}
+
+void enterShared(size_t slot, SExpr* cell) {
+    interp->shared.slots[slot] = cell;
+    interp->shared.count++;
+}
+
+SExpr* shareAtom(SExpr* expr) {
+    int type = typeOf(expr);
+    if (isFixnum(expr) || (type != NUMBER && type != FLOAT && type != BIGNUM)) return promote(expr);
+    size_t slot;
+    SExpr* found = findShared(expr, &slot);
+    if (found) return found;
+    SExpr* cell = promote(expr);
+    enterShared(slot, cell);
+    return cell;
+}
+
+SExpr* shareCons(SExpr* car, SExpr* cdr) {
+    SExpr key = { .type = CONS };
+    key.car = car;
+    key.cdr = cdr;
+    size_t slot;
+    SExpr* found = findShared(&key, &slot);
+    if (found) return found;
+    SExpr* cell = heapAlloc(&interp->heap);
+    cell->type = CONS;
+    cell->car = car;
+    cell->cdr = cdr;
+    enterShared(slot, cell);
+    return cell;
+}
+
+// Walks each list spine iteratively, then rebuilds it from its end so every cdr is canonical first
+SExpr* shareNode(SExpr* expr) {
+    if (typeOf(expr) != CONS) return shareAtom(expr);
+    size_t count = 0;
+    SExpr* p;
+    for (p = expr; typeOf(p) == CONS; p = p->cdr) count++;
+    SExpr** spine = malloc(count * sizeof(SExpr*));
+    if (!spine) {
+        printf("Memory allocation failed for hash-consing\n");
+        exit(1);
+    }
+    count = 0;
+    for (p = expr; typeOf(p) == CONS; p = p->cdr) spine[count++] = p;
+    SExpr* rest = shareAtom(p);
+    while (count > 0) {
+        SExpr* cell = spine[--count];
+        rest = shareCons(shareNode(cell->car), rest);
+    }
+    free(spine);
+    return rest;
+}
+
+// Returns the canonical version of a tree. The result is on the collected heap.
+SExpr* shareTree(SExpr* expr) {
+    interp->heap.inhibit++;     // The spines being rebuilt are only held in malloc'd arrays
+    SExpr* result = shareNode(expr);
+    interp->heap.inhibit--;
+    return result;
+}
+
+// Bignums: integers beyond int64 are a sign and a magnitude, the magnitude an
+// array of 32-bit limbs, least significant first, without leading zero limbs.
+// Results that fit in a long long are always demoted back to a NUMBER, so every
+// value has exactly one representation.
+typedef struct BigInt {
+    uint32_t* limbs;
+    int count;
+    int negative;
+} BigInt;
+
+#define KARATSUBA_THRESHOLD 32  // Limbs; below this schoolbook multiplication wins
+
+uint32_t* allocLimbs(int count) {
+    uint32_t* limbs = malloc((count > 0 ? count : 1) * sizeof(uint32_t));
+    if (!limbs) {
+        printf("Memory allocation failed for bignum\n");
+        exit(1);
+    }
+    return limbs;
+}
+
+int magTrim(const uint32_t* a, int n) {
+    while (n > 0 && a[n - 1] == 0) n--;
+    return n;
+}
+
+int magCompare(const uint32_t* a, int an, const uint32_t* b, int bn) {
+    if (an != bn) return an < bn ? -1 : 1;
+    for (int i = an - 1; i >= 0; i--) {
+        if (a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+// r = a + b; r has room for max(an, bn) + 1 limbs. Returns the trimmed length
+int magAdd(uint32_t* r, const uint32_t* a, int an, const uint32_t* b, int bn) {
+    if (an < bn) {
+        const uint32_t* t = a; a = b; b = t;
+        int n = an; an = bn; bn = n;
+    }
+    uint64_t carry = 0;
+    int i = 0;
+    for (; i < bn; i++) {
+        carry += (uint64_t)a[i] + b[i];
+        r[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    for (; i < an; i++) {
+        carry += a[i];
+        r[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    r[i] = (uint32_t)carry;
+    return magTrim(r, an + 1);
+}
+
+// a += b in place; the sum must fit in an limbs
+void magAddInPlace(uint32_t* a, int an, const uint32_t* b, int bn) {
+    uint64_t carry = 0;
+    for (int i = 0; i < an && (i < bn || carry); i++) {
+        carry += (uint64_t)a[i] + (i < bn ? b[i] : 0);
+        a[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+}
+
+// a -= b in place, with a >= b
+void magSubInPlace(uint32_t* a, int an, const uint32_t* b, int bn) {
+    uint64_t borrow = 0;
+    for (int i = 0; i < an && (i < bn || borrow); i++) {
+        uint64_t subtrahend = (uint64_t)(i < bn ? b[i] : 0) + borrow;
+        borrow = a[i] < subtrahend;
+        a[i] = (uint32_t)(a[i] - subtrahend);
+    }
+}
+
+// a = a * m + add in place; a has room for one more limb. Returns the new length
+int magMulSmallAdd(uint32_t* a, int n, uint32_t m, uint32_t add) {
+    uint64_t carry = add;
+    for (int i = 0; i < n; i++) {
+        carry += (uint64_t)a[i] * m;
+        a[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    if (carry) a[n++] = (uint32_t)carry;
+    return n;
+}
+
+// q = a / d, returning the remainder; q may alias a
+uint32_t magDivSmall(uint32_t* q, const uint32_t* a, int n, uint32_t d) {
+    uint64_t rem = 0;
+    for (int i = n - 1; i >= 0; i--) {
+        uint64_t current = (rem << 32) | a[i];
+        q[i] = (uint32_t)(current / d);
+        rem = current % d;
+    }
+    return (uint32_t)rem;
+}
+
+// r = a * b schoolbook; r has an + bn limbs and must not alias the inputs
+void magMulBasic(uint32_t* r, const uint32_t* a, int an, const uint32_t* b, int bn) {
+    memset(r, 0, (an + bn) * sizeof(uint32_t));
+    for (int i = 0; i < an; i++) {
+        uint64_t carry = 0;
+        for (int j = 0; j < bn; j++) {
+            carry += (uint64_t)a[i] * b[j] + r[i + j];
+            r[i + j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        r[i + bn] = (uint32_t)carry;
+    }
+}
+
+// r = a * b; r has an + bn limbs. Karatsuba splits both operands at m limbs and
+// needs three half-size products instead of four: a0*b0, a1*b1 and
+// (a0 + a1)(b0 + b1), from which the middle term is recovered by subtraction.
+void magMul(uint32_t* r, const uint32_t* a, int an, const uint32_t* b, int bn) {
+    if (an < bn) {
+        const uint32_t* t = a; a = b; b = t;
+        int n = an; an = bn; bn = n;
+    }
+    if (bn < KARATSUBA_THRESHOLD) {
+        magMulBasic(r, a, an, b, bn);
+        return;
+    }
+    memset(r, 0, (an + bn) * sizeof(uint32_t));
+    if (2 * bn <= an) {
+        // Lopsided operands: multiply b by bn-limb slices of a
+        uint32_t* slice = allocLimbs(2 * bn);
+        for (int i = 0; i < an; i += bn) {
+            int length = an - i < bn ? an - i : bn;
+            magMul(slice, a + i, length, b, bn);
+            magAddInPlace(r + i, an + bn - i, slice, length + bn);
+        }
+        free(slice);
+        return;
+    }
+    int m = an / 2;     // bn > m, so both high halves are non-empty
+    int a0n = magTrim(a, m), b0n = magTrim(b, m);
+    int a1n = an - m, b1n = bn - m;
+    magMul(r, a, a0n, b, b0n);
+    magMul(r + 2 * m, a + m, a1n, b + m, b1n);
+
+    uint32_t* sa = allocLimbs(a1n + 1);
+    uint32_t* sb = allocLimbs((b1n > m ? b1n : m) + 1);
+    int san = magAdd(sa, a, a0n, a + m, a1n);
+    int sbn = magAdd(sb, b, b0n, b + m, b1n);
+    uint32_t* middle = allocLimbs(san + sbn);
+    magMul(middle, sa, san, sb, sbn);
+    int middleCount = magTrim(middle, san + sbn);
+    magSubInPlace(middle, middleCount, r, magTrim(r, 2 * m));
+    magSubInPlace(middle, middleCount, r + 2 * m, magTrim(r + 2 * m, a1n + b1n));
+    magAddInPlace(r + m, an + bn - m, middle, magTrim(middle, middleCount));
+    free(sa);
+    free(sb);
+    free(middle);
+}
+
+int leadingZeros(uint32_t x) {
+    int n = 0;
+    while (!(x & 0x80000000u)) {
+        x <<= 1;
+        n++;
+    }
+    return n;
+}
+
+// q = u / v by Knuth's algorithm D, for vn >= 2 and u >= v; q has un - vn + 1 limbs
+void magDiv(uint32_t* q, const uint32_t* u, int un, const uint32_t* v, int vn) {
+    // Normalise so the divisor's top bit is set, which keeps each estimate within 2 of the true digit
+    int shift = leadingZeros(v[vn - 1]);
+    uint32_t* vs = allocLimbs(vn);
+    uint32_t* us = allocLimbs(un + 1);
+    for (int i = vn - 1; i > 0; i--) vs[i] = (v[i] << shift) | (shift ? v[i - 1] >> (32 - shift) : 0);
+    vs[0] = v[0] << shift;
+    us[un] = shift ? u[un - 1] >> (32 - shift) : 0;
+    for (int i = un - 1; i > 0; i--) us[i] = (u[i] << shift) | (shift ? u[i - 1] >> (32 - shift) : 0);
+    us[0] = u[0] << shift;
+
+    for (int j = un - vn; j >= 0; j--) {
+        uint64_t numerator = ((uint64_t)us[j + vn] << 32) | us[j + vn - 1];
+        uint64_t qhat = numerator / vs[vn - 1];
+        uint64_t rhat = numerator % vs[vn - 1];
+        while (qhat > 0xFFFFFFFFu || qhat * vs[vn - 2] > ((rhat << 32) | us[j + vn - 2])) {
+            qhat--;
+            rhat += vs[vn - 1];
+            if (rhat > 0xFFFFFFFFu) break;
+        }
+        // Multiply and subtract
+        int64_t borrow = 0, t;
+        for (int i = 0; i < vn; i++) {
+            uint64_t product = qhat * vs[i];
+            t = (int64_t)us[i + j] - borrow - (int64_t)(product & 0xFFFFFFFFu);
+            us[i + j] = (uint32_t)t;
+            borrow = (int64_t)(product >> 32) - (t >> 32);
+        }
+        t = (int64_t)us[j + vn] - borrow;
+        us[j + vn] = (uint32_t)t;
+        q[j] = (uint32_t)qhat;
+        if (t < 0) {
+            // The estimate was one too large: add the divisor back
+            q[j]--;
+            uint64_t carry = 0;
+            for (int i = 0; i < vn; i++) {
+                carry += (uint64_t)us[i + j] + vs[i];
+                us[i + j] = (uint32_t)carry;
+                carry >>= 32;
+            }
+            us[j + vn] += (uint32_t)carry;
+        }
+    }
+    free(vs);
+    free(us);
+}
+
+BigInt bigAlloc(int count) {
+    BigInt r = { allocLimbs(count), count, 0 };
+    return r;
+}
+
+BigInt bigFromLong(long long value, uint32_t storage[2]) {
+    BigInt view;
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+    storage[0] = (uint32_t)magnitude;
+    storage[1] = (uint32_t)(magnitude >> 32);
+    view.limbs = storage;
+    view.count = magTrim(storage, 2);
+    view.negative = value < 0;
+    return view;
+}
+
+// Borrows the limbs of x, or converts a NUMBER into caller-provided storage
+BigInt bigView(SExpr* x, uint32_t storage[2]) {
+    if (typeOf(x) != BIGNUM) return bigFromLong(numberOf(x), storage);
+    BigInt view = { x->limbs, x->limbCount, x->negative };
+    return view;
+}
+
+BigInt bigCopy(BigInt x) {
+    BigInt r = bigAlloc(x.count);
+    memcpy(r.limbs, x.limbs, x.count * sizeof(uint32_t));
+    r.negative = x.negative;
+    return r;
+}
+
+BigInt bigAdd(BigInt a, BigInt b) {
+    BigInt r = bigAlloc((a.count > b.count ? a.count : b.count) + 1);
+    if (a.negative == b.negative) {
+        r.count = magAdd(r.limbs, a.limbs, a.count, b.limbs, b.count);
+        r.negative = a.negative;
+    } else {
+        if (magCompare(a.limbs, a.count, b.limbs, b.count) < 0) {
+            BigInt t = a; a = b; b = t;
+        }
+        memcpy(r.limbs, a.limbs, a.count * sizeof(uint32_t));
+        magSubInPlace(r.limbs, a.count, b.limbs, b.count);
+        r.count = magTrim(r.limbs, a.count);
+        r.negative = a.negative;
+    }
+    if (r.count == 0) r.negative = 0;
+    return r;
+}
+
+BigInt bigSub(BigInt a, BigInt b) {
+    b.negative = !b.negative;
+    return bigAdd(a, b);
+}
+
+BigInt bigMul(BigInt a, BigInt b) {
+    BigInt r = bigAlloc(a.count + b.count);
+    magMul(r.limbs, a.limbs, a.count, b.limbs, b.count);
+    r.count = magTrim(r.limbs, a.count + b.count);
+    r.negative = r.count > 0 && a.negative != b.negative;
+    return r;
+}
+
+// Truncates toward zero like C division; b must be non-zero
+BigInt bigDiv(BigInt a, BigInt b) {
+    if (magCompare(a.limbs, a.count, b.limbs, b.count) < 0) return bigAlloc(0);
+    int count = a.count - b.count + 1;
+    BigInt r = bigAlloc(count);
+    if (b.count == 1) magDivSmall(r.limbs, a.limbs, a.count, b.limbs[0]);
+    else magDiv(r.limbs, a.limbs, a.count, b.limbs, b.count);
+    r.count = magTrim(r.limbs, count);
+    r.negative = r.count > 0 && a.negative != b.negative;
+    return r;
+}
+
+// Takes ownership of r's limbs
+SExpr* bigResult(BigInt r) {
+    if (r.count <= 2) {
+        uint64_t magnitude = r.count > 0 ? r.limbs[0] | (r.count > 1 ? (uint64_t)r.limbs[1] << 32 : 0) : 0;
+        if (magnitude <= (uint64_t)LLONG_MAX || (r.negative && magnitude == (uint64_t)LLONG_MAX + 1)) {
+            free(r.limbs);
+            return makeNumber(r.negative ? (long long)(0 - magnitude) : (long long)magnitude);
+        }
+    }
+    SExpr* n = allocSExpr();
+    n->type = BIGNUM;
+    n->limbs = r.limbs;
+    n->limbCount = r.count;
+    n->negative = r.negative;
+    trackExternal(n);
+    return n;
+}
+
+// Decimal digits to a number of any size, nine digits per multiply-add step
+SExpr* parseInteger(const char* digits, size_t length, int negative) {
+    BigInt r = bigAlloc((int)(length / 9) + 2);
+    r.count = 0;
+    r.negative = negative;
+    size_t i = 0;
+    while (i < length) {
+        size_t step = i == 0 && length % 9 ? length % 9 : 9;
+        uint32_t chunk = 0, scale = 1;
+        for (size_t k = 0; k < step; k++, i++) {
+            chunk = chunk * 10 + (digits[i] - '0');
+            scale *= 10;
+        }
+        r.count = magMulSmallAdd(r.limbs, r.count, scale, chunk);
+    }
+    if (r.count == 0) r.negative = 0;
+    return bigResult(r);
+}
+
+// Decimal text of a bignum, peeling off nine digits per division. The caller frees it.
+char* bignumToString(SExpr* x) {
+    int n = x->limbCount;
+    uint32_t* scratch = allocLimbs(n);
+    uint32_t* chunks = allocLimbs(n + n / 8 + 2);
+    memcpy(scratch, x->limbs, n * sizeof(uint32_t));
+    int chunkCount = 0;
+    while (n > 0) {
+        chunks[chunkCount++] = magDivSmall(scratch, scratch, n, 1000000000u);
+        n = magTrim(scratch, n);
+    }
+    char* text = malloc(chunkCount * 9 + 2);
+    if (!text) {
+        printf("Memory allocation failed for bignum\n");
+        exit(1);
+    }
+    int length = sprintf(text, "%s%u", x->negative ? "-" : "", chunks[chunkCount - 1]);
+    for (int i = chunkCount - 2; i >= 0; i--) length += sprintf(text + length, "%09u", chunks[i]);
+    free(scratch);
+    free(chunks);
+    return text;
+}
+
+int isNumber(SExpr* expr) {
+    return typeOf(expr) == NUMBER || typeOf(expr) == BIGNUM || typeOf(expr) == FLOAT;
+}
+
+double numberToDouble(SExpr* x);
+
+// Orders two numbers of any representation: negative, zero or positive
+int compareNumbers(SExpr* a, SExpr* b) {
+    // Tagging preserves order, so two fixnums compare as they are
+    if (isFixnum(a) && isFixnum(b)) return ((intptr_t)a > (intptr_t)b) - ((intptr_t)a < (intptr_t)b);
+    if (typeOf(a) == FLOAT || typeOf(b) == FLOAT) {
+        double x = numberToDouble(a), y = numberToDouble(b);
+        return (x > y) - (x < y);
+    }
+    if (typeOf(a) != BIGNUM && typeOf(b) != BIGNUM) {
+        long long x = numberOf(a), y = numberOf(b);
+        return (x > y) - (x < y);
+    }
+    uint32_t sa[2], sb[2];
+    BigInt x = bigView(a, sa), y = bigView(b, sb);
+    if (x.negative != y.negative) return x.negative ? -1 : 1;
+    int order = magCompare(x.limbs, x.count, y.limbs, y.count);
+    return x.negative ? -order : order;
+}
+
+
+// Arithmetic operations. add, sub, mul and div fold any number of operands
+// left to right in a 64-bit accumulator, so only the final result is boxed.
+// A step that overflows moves the fold onto bignums. (sub x) negates and (div x) is 1/x.
+#if defined(__GNUC__)
+#define checkedAdd(a, b, out) __builtin_add_overflow(a, b, out)
+#define checkedSub(a, b, out) __builtin_sub_overflow(a, b, out)
+#define checkedMul(a, b, out) __builtin_mul_overflow(a, b, out)
+#else
+int checkedAdd(long long a, long long b, long long* out) {
+    if ((b > 0 && a > LLONG_MAX - b) || (b < 0 && a < LLONG_MIN - b)) return 1;
+    *out = a + b;
+    return 0;
+}
+
+int checkedSub(long long a, long long b, long long* out) {
+    if ((b < 0 && a > LLONG_MAX + b) || (b > 0 && a < LLONG_MIN + b)) return 1;
+    *out = a - b;
+    return 0;
+}
+
+int checkedMul(long long a, long long b, long long* out) {
+    if (a != 0 && b != 0) {
+        if (a == -1) return checkedSub(0, b, out);
+        if (b == -1) return checkedSub(0, a, out);
+        if ((a > 0) == (b > 0) ? (a > 0 ? a > LLONG_MAX / b : a < LLONG_MAX / b)
+                               : (a > 0 ? b < LLONG_MIN / a : a < LLONG_MIN / b)) return 1;
+    }
+    *out = a * b;
+    return 0;
+}
+#endif
+
+enum { ARITH_OK, ARITH_OVERFLOW, ARITH_DIVIDE_BY_ZERO, ARITH_NOT_A_NUMBER };
+
+// One step on machine integers; *acc is left untouched unless the step succeeds
+int arithStep(int op, long long* acc, long long operand) {
+    long long result;
+    switch (op) {
+        case OP_ADD: if (checkedAdd(*acc, operand, &result)) return ARITH_OVERFLOW; break;
+        case OP_SUB: if (checkedSub(*acc, operand, &result)) return ARITH_OVERFLOW; break;
+        case OP_MUL: if (checkedMul(*acc, operand, &result)) return ARITH_OVERFLOW; break;
+        default:
+            if (operand == 0) return ARITH_DIVIDE_BY_ZERO;
+            if (operand == -1 && *acc == LLONG_MIN) return ARITH_OVERFLOW;
+            result = *acc / operand;
+    }
+    *acc = result;
+    return ARITH_OK;
+}
+
+// A running fold: stays in a long long until a step overflows, then carries on
+// as a bignum. Any FLOAT operand turns the rest of the fold into doubles.
+typedef struct Accumulator {
+    int op;
+    int status;         // ARITH_OK, ARITH_DIVIDE_BY_ZERO or ARITH_NOT_A_NUMBER
+    int isBig;
+    int isFloat;
+    long long small;
+    BigInt big;
+    double real;
+} Accumulator;
+
+SExpr* makeFloat(double value);
+double bigToDouble(SExpr* x);
+
+void accStepFloat(Accumulator* acc, SExpr* operand) {
+    if (!acc->isFloat) {
+        if (acc->isBig) {
+            SExpr view;
+            view.limbs = acc->big.limbs;
+            view.limbCount = acc->big.count;
+            view.negative = acc->big.negative;
+            acc->real = bigToDouble(&view);
+            free(acc->big.limbs);
+            acc->isBig = 0;
+        } else {
+            acc->real = (double)acc->small;
+        }
+        acc->isFloat = 1;
+    }
+    double value = numberToDouble(operand);
+    switch (acc->op) {
+        case OP_ADD: acc->real += value; break;
+        case OP_SUB: acc->real -= value; break;
+        case OP_MUL: acc->real *= value; break;
+        default:
+            if (value == 0) acc->status = ARITH_DIVIDE_BY_ZERO;
+            else acc->real /= value;
+    }
+}
+
+void accStep(Accumulator* acc, SExpr* operand) {
+    if (acc->status != ARITH_OK) return;
+    if (!isNumber(operand)) {
+        acc->status = ARITH_NOT_A_NUMBER;
+        return;
+    }
+    if (acc->isFloat || typeOf(operand) == FLOAT) {
+        accStepFloat(acc, operand);
+        return;
+    }
+    if (!acc->isBig && typeOf(operand) != BIGNUM) {
+        int status = arithStep(acc->op, &acc->small, numberOf(operand));
+        if (status != ARITH_OVERFLOW) {
+            acc->status = status;
+            return;
+        }
+    }
+    uint32_t storage[2], smallStorage[2];
+    if (!acc->isBig) {
+        acc->big = bigCopy(bigFromLong(acc->small, smallStorage));
+        acc->isBig = 1;
+    }
+    BigInt value = bigView(operand, storage), next;
+    switch (acc->op) {
+        case OP_ADD: next = bigAdd(acc->big, value); break;
+        case OP_SUB: next = bigSub(acc->big, value); break;
+        case OP_MUL: next = bigMul(acc->big, value); break;
+        default:
+            if (value.count == 0) {
+                acc->status = ARITH_DIVIDE_BY_ZERO;
+                return;
+            }
+            next = bigDiv(acc->big, value);
+    }
+    free(acc->big.limbs);
+    acc->big = next;
+}
+
+// The fold starts from the first operand, or from the identity when there is only one
+void accStart(Accumulator* acc, int op, SExpr* first, int single) {
+    acc->op = op;
+    acc->status = ARITH_OK;
+    acc->isBig = 0;
+    acc->isFloat = 0;
+    if (!isNumber(first)) {
+        acc->status = ARITH_NOT_A_NUMBER;
+    } else if (single && (op == OP_SUB || op == OP_DIV)) {
+        acc->small = op == OP_SUB ? 0 : 1;
+        accStep(acc, first);
+    } else if (typeOf(first) == FLOAT) {
+        acc->real = first->real;
+        acc->isFloat = 1;
+    } else if (typeOf(first) == BIGNUM) {
+        uint32_t storage[2];
+        acc->big = bigCopy(bigView(first, storage));
+        acc->isBig = 1;
+    } else {
+        acc->small = numberOf(first);
+    }
+}
+
+SExpr* accResult(Accumulator* acc) {
+    if (acc->status != ARITH_OK && acc->isBig) free(acc->big.limbs);
+    if (acc->status == ARITH_NOT_A_NUMBER) return makeError("ARITH: Operands must be numbers");
+    if (acc->status == ARITH_DIVIDE_BY_ZERO) return nil;
+    if (acc->isFloat) return makeFloat(acc->real);
+    return acc->isBig ? bigResult(acc->big) : makeNumber(acc->small);
+}
+
+SExpr* evalArithmetic(int op, SExpr* args) {
+    if (typeOf(args) != CONS) {
+        if (op == OP_ADD) return makeNumber(0);
+        if (op == OP_MUL) return makeNumber(1);
+        return makeError("ARITH: Missing arguments");
+    }
+    Accumulator acc;
+    SExpr* first = eval(args->car);
+    args = args->cdr;
+    accStart(&acc, op, first, typeOf(args) != CONS);
+    for (; typeOf(args) == CONS && acc.status == ARITH_OK; args = args->cdr) accStep(&acc, eval(args->car));
+    return accResult(&acc);
+}
+
+// The same fold over operands the VM has already evaluated
+SExpr* foldArithmetic(int op, SExpr** values, int count) {
+    if (count == 2 && isFixnum(values[0]) && isFixnum(values[1])) {
+        long long small = numberOf(values[0]);
+        if (arithStep(op, &small, numberOf(values[1])) == ARITH_OK) return makeNumber(small);
+    }
+    Accumulator acc;
+    accStart(&acc, op, values[0], count == 1);
+    for (int i = 1; i < count && acc.status == ARITH_OK; i++) accStep(&acc, values[i]);
+    return accResult(&acc);
+}
+
+// Vectors: a VECTOR is a packed, malloc'd array of doubles. The elementwise
+// builtins and reductions run through a kernel table picked once at runtime:
+// AVX2 or SSE2 on x86 when the CPU has them, portable loops everywhere else.
+typedef struct VectorKernels {
+    const char* name;
+    void (*binary)(int op, double* r, const double* a, const double* b, size_t n);
+    void (*scalar)(int op, double* r, const double* a, double s, size_t n);
+    double (*dot)(const double* a, const double* b, size_t n);
+    double (*sum)(const double* a, size_t n);
+    double (*min)(const double* a, size_t n);   // n > 0
+    double (*max)(const double* a, size_t n);   // n > 0
+} VectorKernels;
+
+void binaryScalar(int op, double* r, const double* a, const double* b, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        switch (op) {
+            case OP_ADD: r[i] = a[i] + b[i]; break;
+            case OP_SUB: r[i] = a[i] - b[i]; break;
+            case OP_MUL: r[i] = a[i] * b[i]; break;
+            default: r[i] = a[i] / b[i];
+        }
+    }
+}
+
+void scalarScalar(int op, double* r, const double* a, double s, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        switch (op) {
+            case OP_ADD: r[i] = a[i] + s; break;
+            case OP_SUB: r[i] = a[i] - s; break;
+            case OP_MUL: r[i] = a[i] * s; break;
+            default: r[i] = a[i] / s;
+        }
+    }
+}
+
+double dotScalar(const double* a, const double* b, size_t n) {
+    double total = 0;
+    for (size_t i = 0; i < n; i++) total += a[i] * b[i];
+    return total;
+}
+
+double sumScalar(const double* a, size_t n) {
+    double total = 0;
+    for (size_t i = 0; i < n; i++) total += a[i];
+    return total;
+}
+
+double minScalar(const double* a, size_t n) {
+    double best = a[0];
+    for (size_t i = 1; i < n; i++) best = a[i] < best ? a[i] : best;
+    return best;
+}
+
+double maxScalar(const double* a, size_t n) {
+    double best = a[0];
+    for (size_t i = 1; i < n; i++) best = a[i] > best ? a[i] : best;
+    return best;
+}
+
+VectorKernels scalarKernels = { "scalar", binaryScalar, scalarScalar, dotScalar, sumScalar, minScalar, maxScalar };
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+
+// Each x86 kernel handles whole registers and leaves the tail to the scalar loop
+__attribute__((target("sse2")))
+void binarySse2(int op, double* r, const double* a, const double* b, size_t n) {
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d x = _mm_loadu_pd(a + i), y = _mm_loadu_pd(b + i);
+        switch (op) {
+            case OP_ADD: x = _mm_add_pd(x, y); break;
+            case OP_SUB: x = _mm_sub_pd(x, y); break;
+            case OP_MUL: x = _mm_mul_pd(x, y); break;
+            default: x = _mm_div_pd(x, y);
+        }
+        _mm_storeu_pd(r + i, x);
+    }
+    binaryScalar(op, r + i, a + i, b + i, n - i);
+}
+
+__attribute__((target("sse2")))
+void scalarSse2(int op, double* r, const double* a, double s, size_t n) {
+    size_t i = 0;
+    __m128d y = _mm_set1_pd(s);
+    for (; i + 2 <= n; i += 2) {
+        __m128d x = _mm_loadu_pd(a + i);
+        switch (op) {
+            case OP_ADD: x = _mm_add_pd(x, y); break;
+            case OP_SUB: x = _mm_sub_pd(x, y); break;
+            case OP_MUL: x = _mm_mul_pd(x, y); break;
+            default: x = _mm_div_pd(x, y);
+        }
+        _mm_storeu_pd(r + i, x);
+    }
+    scalarScalar(op, r + i, a + i, s, n - i);
+}
+
+__attribute__((target("sse2")))
+double lanesSse2(__m128d x) {
+    double lanes[2];
+    _mm_storeu_pd(lanes, x);
+    return lanes[0] + lanes[1];
+}
+
+__attribute__((target("sse2")))
+double dotSse2(const double* a, const double* b, size_t n) {
+    __m128d total = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) total = _mm_add_pd(total, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    return lanesSse2(total) + dotScalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("sse2")))
+double sumSse2(const double* a, size_t n) {
+    __m128d total = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) total = _mm_add_pd(total, _mm_loadu_pd(a + i));
+    return lanesSse2(total) + sumScalar(a + i, n - i);
+}
+
+__attribute__((target("sse2")))
+double minSse2(const double* a, size_t n) {
+    if (n < 2) return minScalar(a, n);
+    __m128d best = _mm_loadu_pd(a);
+    size_t i = 2;
+    for (; i + 2 <= n; i += 2) best = _mm_min_pd(best, _mm_loadu_pd(a + i));
+    double lanes[3];
+    _mm_storeu_pd(lanes, best);
+    lanes[2] = i < n ? a[i] : lanes[0];
+    return minScalar(lanes, 3);
+}
+
+__attribute__((target("sse2")))
+double maxSse2(const double* a, size_t n) {
+    if (n < 2) return maxScalar(a, n);
+    __m128d best = _mm_loadu_pd(a);
+    size_t i = 2;
+    for (; i + 2 <= n; i += 2) best = _mm_max_pd(best, _mm_loadu_pd(a + i));
+    double lanes[3];
+    _mm_storeu_pd(lanes, best);
+    lanes[2] = i < n ? a[i] : lanes[0];
+    return maxScalar(lanes, 3);
+}
+
+__attribute__((target("avx2")))
+void binaryAvx2(int op, double* r, const double* a, const double* b, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d x = _mm256_loadu_pd(a + i), y = _mm256_loadu_pd(b + i);
+        switch (op) {
+            case OP_ADD: x = _mm256_add_pd(x, y); break;
+            case OP_SUB: x = _mm256_sub_pd(x, y); break;
+            case OP_MUL: x = _mm256_mul_pd(x, y); break;
+            default: x = _mm256_div_pd(x, y);
+        }
+        _mm256_storeu_pd(r + i, x);
+    }
+    binaryScalar(op, r + i, a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void scalarAvx2(int op, double* r, const double* a, double s, size_t n) {
+    size_t i = 0;
+    __m256d y = _mm256_set1_pd(s);
+    for (; i + 4 <= n; i += 4) {
+        __m256d x = _mm256_loadu_pd(a + i);
+        switch (op) {
+            case OP_ADD: x = _mm256_add_pd(x, y); break;
+            case OP_SUB: x = _mm256_sub_pd(x, y); break;
+            case OP_MUL: x = _mm256_mul_pd(x, y); break;
+            default: x = _mm256_div_pd(x, y);
+        }
+        _mm256_storeu_pd(r + i, x);
+    }
+    scalarScalar(op, r + i, a + i, s, n - i);
+}
+
+__attribute__((target("avx2")))
+double lanesAvx2(__m256d x) {
+    double lanes[4];
+    _mm256_storeu_pd(lanes, x);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+__attribute__((target("avx2")))
+double dotAvx2(const double* a, const double* b, size_t n) {
+    // Two accumulators hide the latency of the adds
+    __m256d even = _mm256_setzero_pd(), odd = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        even = _mm256_add_pd(even, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+        odd = _mm256_add_pd(odd, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+    }
+    return lanesAvx2(_mm256_add_pd(even, odd)) + dotSse2(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+double sumAvx2(const double* a, size_t n) {
+    __m256d even = _mm256_setzero_pd(), odd = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        even = _mm256_add_pd(even, _mm256_loadu_pd(a + i));
+        odd = _mm256_add_pd(odd, _mm256_loadu_pd(a + i + 4));
+    }
+    return lanesAvx2(_mm256_add_pd(even, odd)) + sumSse2(a + i, n - i);
+}
+
+__attribute__((target("avx2")))
+double minAvx2(const double* a, size_t n) {
+    if (n < 4) return minSse2(a, n);
+    __m256d best = _mm256_loadu_pd(a);
+    size_t i = 4;
+    for (; i + 4 <= n; i += 4) best = _mm256_min_pd(best, _mm256_loadu_pd(a + i));
+    double lanes[7];
+    _mm256_storeu_pd(lanes, best);
+    size_t count = 4;
+    for (; i < n; i++) lanes[count++] = a[i];
+    return minScalar(lanes, count);
+}
+
+__attribute__((target("avx2")))
+double maxAvx2(const double* a, size_t n) {
+    if (n < 4) return maxSse2(a, n);
+    __m256d best = _mm256_loadu_pd(a);
+    size_t i = 4;
+    for (; i + 4 <= n; i += 4) best = _mm256_max_pd(best, _mm256_loadu_pd(a + i));
+    double lanes[7];
+    _mm256_storeu_pd(lanes, best);
+    size_t count = 4;
+    for (; i < n; i++) lanes[count++] = a[i];
+    return maxScalar(lanes, count);
+}
+
+VectorKernels sse2Kernels = { "sse2", binarySse2, scalarSse2, dotSse2, sumSse2, minSse2, maxSse2 };
+VectorKernels avx2Kernels = { "avx2", binaryAvx2, scalarAvx2, dotAvx2, sumAvx2, minAvx2, maxAvx2 };
+#endif
+
+VectorKernels* kernels = NULL;
+
+void selectKernels() {
+    kernels = &scalarKernels;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) kernels = &avx2Kernels;
+    else if (__builtin_cpu_supports("sse2")) kernels = &sse2Kernels;
+#endif
+}
+
+VectorKernels* vectorKernels() {
+#ifdef LISP_THREADS
+    static pthread_once_t selected = PTHREAD_ONCE_INIT;    // Any thread of any instance may get here first
+    pthread_once(&selected, selectKernels);
+#else
+    if (!kernels) selectKernels();
+#endif
+    return kernels;
+}
+
+SExpr* makeFloat(double value) {
+    SExpr* f = allocSExpr();
+    f->type = FLOAT;
+    f->real = value;
+    return f;
+}
+
+double bigToDouble(SExpr* x) {
+    double value = 0;
+    for (int i = x->limbCount - 1; i >= 0; i--) value = value * 4294967296.0 + x->limbs[i];
+    return x->negative ? -value : value;
+}
+
+double numberToDouble(SExpr* x) {
+    if (typeOf(x) == FLOAT) return x->real;
+    if (typeOf(x) == BIGNUM) return bigToDouble(x);
+    return (double)numberOf(x);
+}
+
+int listLength(SExpr* args);
+
+// A vector of length elements, left uninitialised
+SExpr* makeVector(int length) {
+    double* elements = malloc((length > 0 ? length : 1) * sizeof(double));
+    if (!elements) {
+        printf("Memory allocation failed for vector\n");
+        exit(1);
+    }
+    SExpr* v = allocSExpr();
+    v->type = VECTOR;
+    v->elements = elements;
+    v->length = length;
+    trackExternal(v);
+    return v;
+}
+
+// (vector x...)
+SExpr* evalVector(SExpr* args) {
+    int length = listLength(args);
+    if (length < 0) return makeError("VECTOR: Malformed argument list");
+    SExpr* v = makeVector(length);
+    for (int i = 0; i < length; i++, args = args->cdr) {
+        SExpr* element = eval(args->car);
+        if (!isNumber(element)) return makeError("VECTOR: Elements must be numbers");
+        v->elements[i] = numberToDouble(element);
+    }
+    return v;
+}
+
+// (vadd a b), (vmul a b): elementwise over two vectors of the same length
+SExpr* evalVectorBinary(int op, SExpr* args) {
+    SExpr* a = eval(args->car);
+    SExpr* b = eval(args->cdr->car);
+    if (typeOf(a) != VECTOR || typeOf(b) != VECTOR) return makeError("VECTOR: Arguments must be vectors");
+    if (a->length != b->length) return makeError("VECTOR: Length mismatch");
+    SExpr* r = makeVector(a->length);
+    vectorKernels()->binary(op, r->elements, a->elements, b->elements, a->length);
+    return r;
+}
+
+SExpr* evalDot(SExpr* args) {
+    SExpr* a = eval(args->car);
+    SExpr* b = eval(args->cdr->car);
+    if (typeOf(a) != VECTOR || typeOf(b) != VECTOR) return makeError("VECTOR: Arguments must be vectors");
+    if (a->length != b->length) return makeError("VECTOR: Length mismatch");
+    return makeFloat(vectorKernels()->dot(a->elements, b->elements, a->length));
+}
+
+// (vsum v), (vmin v), (vmax v); min and max of an empty vector are nil
+SExpr* evalReduce(int opcode, SExpr* args) {
+    SExpr* v = eval(args->car);
+    if (typeOf(v) != VECTOR) return makeError("VECTOR: Argument must be a vector");
+    VectorKernels* k = vectorKernels();
+    if (opcode == OP_VSUM) return makeFloat(k->sum(v->elements, v->length));
+    if (v->length == 0) return nil;
+    return makeFloat(opcode == OP_VMIN ? k->min(v->elements, v->length) : k->max(v->elements, v->length));
+}
+
+SExpr* apply(SExpr* fn, SExpr** values, int argc);
+
+// (vmap op v x) applies the arithmetic operator op (not evaluated) with the
+// scalar x to every element. (vmap f v) calls a one-argument lambda per element.
+SExpr* evalVectorMap(SExpr* args) {
+    SExpr* op = args->car;
+    SExpr* v = eval(args->cdr->car);
+    if (typeOf(v) != VECTOR) return makeError("VECTOR: Second argument must be a vector");
+    SExpr* r = makeVector(v->length);
+    if (typeOf(args->cdr->cdr) == CONS) {
+        int opcode = typeOf(op) == SYMBOL ? op->opcode : OP_NONE;
+        if (opcode != OP_ADD && opcode != OP_SUB && opcode != OP_MUL && opcode != OP_DIV) {
+            return makeError("VMAP: Operator must be add, sub, mul or div");
+        }
+        SExpr* x = eval(args->cdr->cdr->car);
+        if (!isNumber(x)) return makeError("VMAP: Scalar must be a number");
+        vectorKernels()->scalar(opcode, r->elements, v->elements, numberToDouble(x), v->length);
+        return r;
+    }
+    SExpr* fn = eval(op);
+    if (typeOf(fn) != LAMBDA) return makeError("VMAP: Function must be a lambda");
+    for (int i = 0; i < v->length; i++) {
+        SExpr* element = makeFloat(v->elements[i]);
+        SExpr* result = apply(fn, &element, 1);
+        if (!isNumber(result)) return makeError("VMAP: Function must return a number");
+        r->elements[i] = numberToDouble(result);
+    }
+    return r;
+}
+
+// Logical operations
+// The control forms leave their tail expression in *tail and return NULL, so
+// eval() can continue with it in place rather than recursing
+SExpr* evalAnd(SExpr* expr, SExpr** tail) {
+    if (listLength(expr) != 2) return makeError("AND: Expected two arguments");
+    SExpr* e1 = eval(expr->car);
+    if (!isTruthy(e1)) return nil;
+    *tail = expr->cdr->car;
+    return NULL;
+}
+
+SExpr* evalOr(SExpr* expr, SExpr** tail) {
+    if (listLength(expr) != 2) return makeError("OR: Expected two arguments");
+    SExpr* e1 = eval(expr->car);
+    if (isTruthy(e1)) return e1;
+    *tail = expr->cdr->car;
+    return NULL;
+}
+
+// Conditional `if` expression
+SExpr* evalIf(SExpr* expr, SExpr** tail) {
+    if (listLength(expr) != 3) return makeError("IF: Expected a condition and two branches");
+    SExpr* condition = eval(expr->car);
+    *tail = isTruthy(condition) ? expr->cdr->car : expr->cdr->cdr->car;
+    return NULL;
+}
+
+// The `cond` construct evaluation
+SExpr* evalCond(SExpr* expr, SExpr** tail) {
+    while (expr != nil) {
+        // Check that `expr` is a cons cell
+        if (typeOf(expr) != CONS) {
+            return makeError("COND: Malformed clause list - expected cons cell");
+        }
+        
+        SExpr* pair = expr->car;  // Extract the current clause
+        if (typeOf(pair) != CONS) {
+            return makeError("COND: Each clause must be a cons cell with a condition and result");
+        }
+
+        // Extract the condition
+        SExpr* condition = pair->car;
+        if (condition == nil) {
+            return makeError("COND: Missing condition in clause");
+        }
+
+        // Extract the result
+        if (pair->cdr == nil) {
+            return makeError("COND: Missing or malformed result in clause");
+        }
+        
+        SExpr* result = pair->cdr;
+        // Evaluate the condition
+        SExpr* eval_condition = eval(condition);
+
+        // Check if the condition is truthy
+        if (eval_condition != nil) {
+            // The result is evaluated by the caller, in tail position
+            *tail = result;
+            return NULL;
+        }
+
+        // Move to the next condition-result pair
+        expr = expr->car->cdr;
+    }
+
+    return nil;  // If no condition is truthy, return nil
+}
+
+// Comparison operations. Both operands must be numbers; the VM shares compareOperands
+SExpr* compareOperands(int op, SExpr* a, SExpr* b) {
+    if (!isNumber(a) || !isNumber(b)) return makeError("COMPARE: Operands must be numbers");
+    int order = compareNumbers(a, b);
+    switch (op) {
+        case OP_GT: return order > 0 ? truth : nil;
+        case OP_LT: return order < 0 ? truth : nil;
+        case OP_GE: return order >= 0 ? truth : nil;
+        default: return order <= 0 ? truth : nil;
+    }
+}
+
+SExpr* evalGreaterThan(SExpr* expr) {
+    SExpr* a = eval(expr->car);
+    return compareOperands(OP_GT, a, eval(expr->cdr->car));
+}
+
+SExpr* evalLessThan(SExpr* expr) {
+    SExpr* a = eval(expr->car);
+    return compareOperands(OP_LT, a, eval(expr->cdr->car));
+}
+
+SExpr* evalGreaterEqual(SExpr* expr) {
+    SExpr* a = eval(expr->car);
+    return compareOperands(OP_GE, a, eval(expr->cdr->car));
+}
+
+SExpr* evalLessEqual(SExpr* expr) {
+    SExpr* a = eval(expr->car);
+    return compareOperands(OP_LE, a, eval(expr->cdr->car));
+}
+
+// Symbols are interned, so the name pointer is the key and its cached hash picks the slot
+Env* lookupBinding(SExpr* name) {
+    EnvSlots* table = LOAD_ACQUIRE(interp->globals.table);
+    if (!table) return NULL;
+    size_t mask = table->capacity - 1;
+    for (size_t i = name->hash & mask;; i = (i + 1) & mask) {
+        Env* binding = LOAD_ACQUIRE(table->slots[i]);
+        if (!binding || binding->name == name) return binding;
+    }
+}
+
+// Places a binding in a table no reader can see yet, or in an empty slot of the live one
+void insertBinding(EnvSlots* table, Env* binding) {
+    size_t mask = table->capacity - 1;
+    size_t i = binding->name->hash & mask;
+    while (LOAD_ACQUIRE(table->slots[i])) i = (i + 1) & mask;
+    STORE_RELEASE(table->slots[i], binding);
+}
+
+// Publishes a table twice the size; the old one is retired, not freed
+int growEnv() {
+    EnvSlots* old = LOAD_ACQUIRE(interp->globals.table);
+    size_t capacity = old ? old->capacity * 2 : 64;
+    EnvSlots* table = calloc(1, sizeof(EnvSlots) + capacity * sizeof(Env*));
+    if (!table) return 0;
+    table->capacity = capacity;
+    table->retired = old;
+    for (size_t i = 0; old && i < old->capacity; i++) {
+        Env* binding = LOAD_ACQUIRE(old->slots[i]);
+        if (binding) insertBinding(table, binding);
+    }
+    STORE_RELEASE(interp->globals.table, table);
+    return 1;
+}
+
+void set(SExpr* name, SExpr* value) {
+#ifdef LISP_THREADS
+    if (currentWorker) workerEscape(1);    // Workers never write globals; the form is rerun serially
+#endif
+    // Ensure name is a symbol
+    if (typeOf(name) != SYMBOL) {
+        fprintf(stderr, "Error: Name must be a symbol\n");
+        return;
+    }
+
+    // Values must outlive the scratch arena of the form that computed them
+    value = promote(value);
+    if (typeOf(value) == LAMBDA && !value->lambdaName) value->lambdaName = name;
+
+    LOCK_SHARED(interp->globals.writeLock);
+    // Check if the symbol already exists in the environment
+    Env* current = lookupBinding(name);
+    if (current) {
+        STORE_RELEASE(current->value, value); // Update value
+        UNLOCK_SHARED(interp->globals.writeLock);
+        return;
+    }
+
+    // Add a new entry to the environment
+    EnvSlots* table = LOAD_ACQUIRE(interp->globals.table);
+    if ((!table || (interp->globals.count + 1) * 2 > table->capacity) && !growEnv()) {
+        UNLOCK_SHARED(interp->globals.writeLock);
+        fprintf(stderr, "Error: Memory allocation failed for environment table\n");
+        return;
+    }
+    Env* new_entry = malloc(sizeof(Env));
+    if (!new_entry) {
+        UNLOCK_SHARED(interp->globals.writeLock);
+        fprintf(stderr, "Error: Memory allocation failed for environment entry\n");
+        return;
+    }
+    new_entry->name = name;
+    new_entry->value = value;
+    insertBinding(LOAD_ACQUIRE(interp->globals.table), new_entry);
+    interp->globals.count++;
+    STORE_RELEASE(interp->globals.version, LOAD_ACQUIRE(interp->globals.version) + 1);
+    UNLOCK_SHARED(interp->globals.writeLock);
+}
+
+SExpr* get(SExpr* name) {
+    // Ensure name is a symbol
+    if (typeOf(name) != SYMBOL) {
+        fprintf(stderr, "Error: Name must be a symbol\n");
+        return nil;
+    }
+
+    // Search for the symbol in the environment
+    Env* current = lookupBinding(name);
+    return current ? LOAD_ACQUIRE(current->value) : nil; // nil if symbol not found
+}
+
+void initGlobalCache(GlobalCache* cache, SExpr* name) {
+    cache->name = name;
+    cache->binding = NULL;
+    cache->version = CACHE_UNFILLED;
+}
+
+// get() through a reference site's cache: one load once the binding is known.
+// The version is read before probing, so a binding added meanwhile leaves the
+// recorded miss already stale. Racing fills store the same answer.
+SExpr* cachedGet(GlobalCache* cache) {
+    Env* binding = LOAD_ACQUIRE(cache->binding);
+    if (binding) return LOAD_ACQUIRE(binding->value);
+    size_t version = LOAD_ACQUIRE(interp->globals.version);
+    if (LOAD_ACQUIRE(cache->version) == version) return nil;
+    binding = lookupBinding(cache->name);
+    if (!binding) {
+        STORE_RELEASE(cache->version, version);
+        return nil;
+    }
+    STORE_RELEASE(cache->binding, binding);
+    return LOAD_ACQUIRE(binding->value);
+}
+
+SExpr* eq(SExpr* a, SExpr* b) {
+    // printf(a->number);
+    // printf(" ");
+    // printf(b->number);
+    // printf("\n");
+    // Compare numbers
+    if (isNumber(a) && isNumber(b)) {
+        // printf("Is Number");
+        // printf("\n");
+        return compareNumbers(a, b) == 0 ? truth : nil;
+    }
+
+    // Compare symbols (interned, so identity is equality)
+    if (typeOf(a) == SYMBOL && typeOf(b) == SYMBOL) {
+        // printf("Is Symbol");
+        // printf("\n");
+        return a == b ? truth : nil;
+    }
+
+    // Compare lists by identity, which is structural equality for hash-consed data
+    if (typeOf(a) == CONS && typeOf(b) == CONS) return a == b ? truth : nil;
+
+    // Types mismatch
+    return nil;
+}
+
+SExpr* execute(SExpr* code);
+
+// Lambdas: when a lambda form is evaluated its body is resolved once, turning
+// every reference to an enclosing parameter into a LOCAL (frame depth, slot)
+// and every other variable reference into a GLOBAL carrying its inline cache.
+// A call then binds its arguments in a flat FRAME whose parent is the frame
+// the closure captured, so variable lookup never searches by name.
+typedef struct Scope {
+    SExpr* params;
+    struct Scope* parent;
+} Scope;
+
+SExpr* makeLambda(SExpr* params, SExpr* body, SExpr* env) {
+    SExpr* lambda = allocSExpr();
+    lambda->type = LAMBDA;
+    lambda->params = params;
+    lambda->body = body;
+    lambda->env = env;
+    lambda->arity = listLength(params);
+    lambda->lambdaName = NULL;
+    return lambda;
+}
+
+SExpr* makeLocal(SExpr* name, int depth, int slot) {
+    SExpr* local = allocSExpr();
+    local->type = LOCAL;
+    local->localName = name;
+    local->depth = depth;
+    local->slot = slot;
+    return local;
+}
+
+SExpr* makeGlobal(SExpr* name) {
+    SExpr* global = allocSExpr();
+    global->type = GLOBAL;
+    initGlobalCache(&global->global, name);
+    return global;
+}
+
+// Parameters must be a proper list of ordinary symbols
+int isParamList(SExpr* params) {
+    for (; typeOf(params) == CONS; params = params->cdr) {
+        if (typeOf(params->car) != SYMBOL || params->car == truth) return 0;
+    }
+    return params == nil;
+}
+
+int findLocal(SExpr* name, Scope* scope, int* depth, int* slot) {
+    for (*depth = 0; scope; scope = scope->parent, (*depth)++) {
+        *slot = 0;
+        for (SExpr* p = scope->params; typeOf(p) == CONS; p = p->cdr, (*slot)++) {
+            if (p->car == name) return 1;
+        }
+    }
+    return 0;
+}
+
+SExpr* resolve(SExpr* expr, Scope* scope);
+
+SExpr* resolveList(SExpr* list, Scope* scope) {
+    SExpr* result = nil;
+    SExpr** tail = &result;
+    for (; typeOf(list) == CONS; list = list->cdr) {
+        *tail = cons(resolve(list->car, scope), nil);
+        tail = &(*tail)->cdr;
+    }
+    *tail = resolve(list, scope);
+    return result;
+}
+
+SExpr* resolve(SExpr* expr, Scope* scope) {
+    int depth, slot;
+    if (typeOf(expr) == SYMBOL) {
+        if (findLocal(expr, scope, &depth, &slot)) return makeLocal(expr, depth, slot);
+        // Operators stay symbols so heads still dispatch on their opcode
+        return expr == truth || expr->opcode != OP_NONE ? expr : makeGlobal(expr);
+    }
+    if (typeOf(expr) != CONS) return expr;
+    SExpr* head = expr->car;
+    SExpr* args = expr->cdr;
+    // A parameter may shadow a special form, so only unbound heads are treated specially
+    if (typeOf(head) == SYMBOL && !findLocal(head, scope, &depth, &slot)) {
+        switch (head->opcode) {
+            case OP_QUOTE:
+                return expr;
+            case OP_SET:
+                if (typeOf(args) != CONS) break;
+                return cons(head, cons(args->car, resolveList(args->cdr, scope)));
+            case OP_LAMBDA:
+                if (typeOf(args) != CONS || typeOf(args->cdr) != CONS || !isParamList(args->car)) break;
+                Scope inner = { args->car, scope };
+                // A template: evaluating it captures the current frame
+                return makeLambda(args->car, resolve(args->cdr->car, &inner), NULL);
+        }
+    }
+    return resolveList(expr, scope);
+}
+
+SExpr* lookupLocal(SExpr* local) {
+    SExpr* frame = currentFrame;
+    for (int depth = local->depth; depth > 0; depth--) frame = frame->parent;
+    return frameSlots(frame)[local->slot];
+}
+
+// Binds a call's arguments. A frame the evaluator owns and no closure has
+// captured is overwritten in place when the slot layout allows it.
+SExpr* bindFrame(SExpr* fn, SExpr** values, int argc, SExpr* reusable) {
+#ifdef LISP_THREADS
+    if (currentWorker) workerCheckpoint();
+#endif
+    SExpr* frame = reusable;
+    if (!frame || frame->captured || (frame->slotCount != argc &&
+            (frame->slotCount > FRAME_INLINE_SLOTS || argc > FRAME_INLINE_SLOTS))) {
+        frame = allocSExpr();
+        frame->type = FRAME;
+        frame->captured = 0;
+        frame->slots = NULL;
+        if (argc > FRAME_INLINE_SLOTS) {
+            frame->slots = malloc(argc * sizeof(SExpr*));
+            if (!frame->slots) {
+                printf("Memory allocation failed for frame\n");
+                exit(1);
+            }
+            trackExternal(frame);
+        }
+    }
+    frame->parent = fn->env;
+    frame->slotCount = argc;
+    if (argc > 0) memcpy(frameSlots(frame), values, argc * sizeof(SExpr*));
+    return frame;
+}
+
+// Shadow call stack: the names of the closures being called on this thread,
+// innermost CALL_STACK_DEPTH kept in a ring. The sampler's signal handler reads
+// it from the interrupted thread, hence volatile.
+#define CALL_STACK_DEPTH 64
+
+typedef struct CallStack {
+    volatile int depth;
+    SExpr* volatile names[CALL_STACK_DEPTH];
+} CallStack;
+
+THREAD_LOCAL CallStack callStack;
+
+// A tail call replaces its caller's entry instead of pushing
+void enterCall(SExpr* fn, int tail) {
+    int depth = callStack.depth - tail;
+    callStack.names[depth & (CALL_STACK_DEPTH - 1)] = fn->lambdaName;
+    callStack.depth = depth + 1;
+}
+
+// Sampling profiler. A SIGPROF timer interrupts whichever thread is burning CPU
+// and the handler copies that thread's call stack into a preallocated pool,
+// reserving space with one atomic add so it never locks or allocates. The
+// samples are folded into "outer;inner count" lines for flame graph tools.
+#ifdef LISP_SAMPLING
+#define SAMPLE_POOL_WORDS (1 << 20)
+#define SAMPLE_HZ 997             // Off the round numbers so samples don't lock step with periodic work
+
+typedef struct Sampler {
+    uintptr_t* pool;            // Per sample: frame count, then that many name symbols, outermost first
+    atomic_size_t used;
+    atomic_long dropped;        // Samples that arrived once the pool was full
+    struct sigaction previous;
+    int active;
+} Sampler;
+
+Sampler sampler;
+
+void sampleHandler(int signo) {
+    (void)signo;
+    int depth = callStack.depth;
+    int stored = depth < CALL_STACK_DEPTH ? depth : CALL_STACK_DEPTH;
+    size_t at = atomic_fetch_add_explicit(&sampler.used, stored + 2, memory_order_relaxed);
+    if (at + stored + 2 > SAMPLE_POOL_WORDS) {
+        atomic_fetch_add_explicit(&sampler.dropped, 1, memory_order_relaxed);
+        return;
+    }
+    sampler.pool[at] = stored;
+    sampler.pool[at + 1] = depth > stored;     // Truncated: outer frames were overwritten in the ring
+    for (int i = 0; i < stored; i++) {
+        sampler.pool[at + 2 + i] = (uintptr_t)callStack.names[(depth - stored + i) & (CALL_STACK_DEPTH - 1)];
+    }
+}
+
+// Starts sampling at hz samples per second of CPU time. Returns 0 if it can't.
+int startSampling(int hz) {
+    if (sampler.active || hz <= 0) return 0;
+    if (!sampler.pool) sampler.pool = malloc(SAMPLE_POOL_WORDS * sizeof(uintptr_t));
+    if (!sampler.pool) return 0;
+    atomic_store(&sampler.used, 0);
+    atomic_store(&sampler.dropped, 0);
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = sampleHandler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, &sampler.previous) != 0) return 0;
+    long interval = hz >= 1000000 ? 1 : 1000000 / hz;
+    struct itimerval timer = { { interval / 1000000, interval % 1000000 }, { interval / 1000000, interval % 1000000 } };
+    if (setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+        sigaction(SIGPROF, &sampler.previous, NULL);
+        return 0;
+    }
+    sampler.active = 1;
+    return 1;
+}
+
+void stopSampling() {
+    if (!sampler.active) return;
+    struct itimerval off;
+    memset(&off, 0, sizeof(off));
+    setitimer(ITIMER_PROF, &off, NULL);
+    sigaction(SIGPROF, &sampler.previous, NULL);
+    sampler.active = 0;
+}
+#endif
+
+SExpr* evalTail(SExpr* expr, SExpr* ownFrame);
+
+// Calls a closure with already evaluated arguments
+SExpr* apply(SExpr* fn, SExpr** values, int argc) {
+    if (argc != fn->arity) return makeError("APPLY: Wrong number of arguments");
+    SExpr* saved = currentFrame;
+    enterCall(fn, 0);
+    currentFrame = bindFrame(fn, values, argc, NULL);
+    SExpr* result = evalTail(fn->body, currentFrame);
+    currentFrame = saved;
+    callStack.depth--;
+    return result;
+}
+
+// Evaluation function for all expressions
+SExpr* eval(SExpr* expr) {
+    SExpr* saved = currentFrame;
+    SExpr* result = evalTail(expr, NULL);
+    if (currentFrame != saved) callStack.depth--;   // evalTail called a closure, which left one entry
+    currentFrame = saved;
+    return result;
+}
+
+// Special forms and builtins. Returns NULL when the form continues in tail
+// position, having stored the expression to evaluate next in *expr.
+SExpr* evalOperator(int opcode, SExpr* args, SExpr** expr) {
+    SExpr* result;
+    switch (opcode) {
+        case OP_QUOTE:
+            if (args == nil || typeOf(args) != CONS) {
+                return makeError("QUOTE: Missing or malformed argument");
+            }
+            return args->car; // Return cadr (car of cdr)
+        case OP_SET: {
+            if (args == nil || typeOf(args) != CONS || args->cdr == nil || typeOf(args->cdr) != CONS) {
+                return makeError("SET: Missing or malformed arguments");
+            }
+            SExpr* name = args->car;         // First argument
+            SExpr* valueExpr = args->cdr->car; // Second argument (value)
+            
+            if (typeOf(name) != SYMBOL) {
+                return makeError("SET: First argument must be a symbol");
+            }
+            
+            SExpr* value = eval(valueExpr); // Evaluate value
+            if (value == nil) {
+                return makeError("SET: Error evaluating value");
+            }
+
+            set(name, value); // Store in environment
+            return value;     // Return the evaluated value
+        }
+        case OP_EQ: {
+            if (listLength(args) != 2) return makeError("EQ: Expected two arguments");
+            SExpr* arg1 = eval(args->car);
+            SExpr* arg2 = eval(args->cdr->car);
+            return eq(arg1, arg2);
+        }
+        case OP_LAMBDA: {
+            if (typeOf(args) != CONS || typeOf(args->cdr) != CONS || !isParamList(args->car)) {
+                return makeError("LAMBDA: Malformed parameter list or missing body");
+            }
+            SExpr* params = args->car;
+            Scope scope = { params, NULL };
+            return makeLambda(params, resolve(args->cdr->car, &scope), nil);
+        }
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+            return evalArithmetic(opcode, args);
+        case OP_AND: result = evalAnd(args, expr); break;
+        case OP_OR: result = evalOr(args, expr); break;
+        case OP_IF: result = evalIf(args, expr); break;
+        case OP_COND: result = evalCond(args, expr); break;
+        case OP_GT: case OP_LT: case OP_GE: case OP_LE:
+            if (listLength(args) != 2) return makeError("COMPARE: Expected two arguments");
+            if (opcode == OP_GT) return evalGreaterThan(args);
+            if (opcode == OP_LT) return evalLessThan(args);
+            if (opcode == OP_GE) return evalGreaterEqual(args);
+            return evalLessEqual(args);
+        case OP_VECTOR: return evalVector(args);
+        case OP_VADD: case OP_VMUL: case OP_DOT: case OP_VSUM: case OP_VMIN: case OP_VMAX: case OP_VMAP: {
+            int argc = listLength(args);
+            int wanted = opcode >= OP_VSUM && opcode <= OP_VMAX ? 1 : 2;
+            if (argc != wanted && !(opcode == OP_VMAP && argc == 3)) {
+                return makeError("VECTOR: Wrong number of arguments");
+            }
+            if (opcode == OP_VADD) return evalVectorBinary(OP_ADD, args);
+            if (opcode == OP_VMUL) return evalVectorBinary(OP_MUL, args);
+            if (opcode == OP_DOT) return evalDot(args);
+            if (opcode == OP_VMAP) return evalVectorMap(args);
+            return evalReduce(opcode, args);
+        }
+        default: return nil;
+    }
+    return result;
+}
+
+// The evaluator proper. Tail positions (if branches, the chosen cond result, the
+// last operand of and/or, and closure bodies) jump back to the top instead of
+// recursing, so tail calls run in constant C stack. ownFrame is the frame this loop created, which a
+// tail call may reuse. The caller restores currentFrame afterwards.
+SExpr* evalTail(SExpr* expr, SExpr* ownFrame) {
+tailCall:
+    if (expr == nil) return nil;
+    if (typeOf(expr) == NUMBER || typeOf(expr) == NIL || typeOf(expr) == BIGNUM || typeOf(expr) == FLOAT) return expr;
+    if (typeOf(expr) == CODE) return execute(expr);
+    if (typeOf(expr) == LOCAL) return lookupLocal(expr);
+    if (typeOf(expr) == GLOBAL) {
+        PROFILE_BEGIN();
+        SExpr* value = cachedGet(&expr->global);
+        PROFILE_END(PROFILE_GET);
+        return value;
+    }
+    if (typeOf(expr) == LAMBDA) {
+        if (expr->env) return expr;
+        if (!currentFrame) return makeLambda(expr->params, expr->body, nil);
+        currentFrame->captured = 1;
+        return makeLambda(expr->params, expr->body, currentFrame);
+    }
+    if (typeOf(expr) == SYMBOL) {
+        if (expr == truth) return expr;
+        PROFILE_BEGIN();
+        SExpr* value = get(expr);
+        PROFILE_END(PROFILE_GET);
+        return value;
+    }
+    if (typeOf(expr) != CONS) return nil;
+    SExpr* function = expr->car;  // First element
+    SExpr* args = expr->cdr;  
+    if (typeOf(function) != SYMBOL || function->opcode == OP_NONE) {
+        // (f args...) where f is not a special form or builtin
+        PROFILE_BEGIN();
+        SExpr* fn = eval(function);
+        if (typeOf(fn) != LAMBDA) return nil;   // Not a procedure, same as an unknown operator
+        int argc = listLength(args);
+        if (argc < 0) return makeError("APPLY: Malformed argument list");
+        if (argc != fn->arity) return makeError("APPLY: Wrong number of arguments");
+        SExpr* values[argc > 0 ? argc : 1];
+        for (int i = 0; i < argc; i++, args = args->cdr) values[i] = eval(args->car);
+        enterCall(fn, ownFrame != NULL);
+        currentFrame = ownFrame = bindFrame(fn, values, argc, ownFrame);
+        PROFILE_END(PROFILE_CALL);
+        expr = fn->body;
+        goto tailCall;
+    }
+    PROFILE_BEGIN();
+    SExpr* result = evalOperator(function->opcode, args, &expr);
+    PROFILE_END(function->opcode);
+    if (result) return result;
+    goto tailCall;
+}
+
+// Optimizer: a pass over a form before it is evaluated or compiled. Pure
+// builtins whose operands are all constants are folded to their value, if and
+// cond drop the branches a constant condition rules out, and and/or with a
+// constant first operand reduce to one of their operands. A parameter may
+// shadow an operator, so lambda bodies are walked with their scope as in
+// resolve(). Unchanged subtrees are shared with the input.
+
+// Numbers, t, nil and quoted data: evaluating them has no effect
+int isConstant(SExpr* expr, Scope* scope) {
+    int type = typeOf(expr);
+    if (expr == nil || expr == truth || type == NUMBER || type == BIGNUM || type == FLOAT) return 1;
+    int depth, slot;
+    return type == CONS && typeOf(expr->car) == SYMBOL && expr->car->opcode == OP_QUOTE &&
+        typeOf(expr->cdr) == CONS && !findLocal(expr->car, scope, &depth, &slot);
+}
+
+SExpr* constantValue(SExpr* expr) {
+    return typeOf(expr) == CONS ? expr->cdr->car : expr;
+}
+
+// Evaluates a pure builtin over constant operands. Returns NULL when that makes
+// an error, which is left to be raised when the form really runs.
+SExpr* foldPure(SExpr* head, SExpr* args) {
+    char* savedError = interp->error;
+    interp->error = NULL;
+    SExpr* value = eval(cons(head, args));
+    int failed = interp->error != NULL;
+    interp->error = savedError;
+    int type = typeOf(value);
+    if (failed || !(value == nil || value == truth || type == NUMBER || type == BIGNUM || type == FLOAT)) return NULL;
+    return value;
+}
+
+SExpr* optimizeExpr(SExpr* expr, Scope* scope);
+
+// Optimizes each element of a list, copying only the cells up to the last one that changed
+SExpr* optimizeList(SExpr* list, Scope* scope) {
+    SExpr* result = list;
+    SExpr** tail = &result;
+    SExpr* shared = list;       // Start of the suffix that is still the input's
+    for (SExpr* p = list; typeOf(p) == CONS; p = p->cdr) {
+        SExpr* element = optimizeExpr(p->car, scope);
+        if (element == p->car) continue;
+        for (; shared != p; shared = shared->cdr) {
+            *tail = cons(shared->car, nil);
+            tail = &(*tail)->cdr;
+        }
+        *tail = cons(element, nil);
+        tail = &(*tail)->cdr;
+        shared = p->cdr;
+    }
+    if (tail != &result) *tail = shared;
+    return result;
+}
+
+int allConstant(SExpr* list, Scope* scope) {
+    for (; typeOf(list) == CONS; list = list->cdr) {
+        if (!isConstant(list->car, scope)) return 0;
+    }
+    return list == nil;
+}
+
+SExpr* optimizeExpr(SExpr* expr, Scope* scope) {
+    if (typeOf(expr) != CONS) return expr;
+    SExpr* head = expr->car;
+    SExpr* args = expr->cdr;
+    int argc = listLength(args);
+    int depth, slot;
+    int opcode = typeOf(head) == SYMBOL && !findLocal(head, scope, &depth, &slot) ? head->opcode : OP_NONE;
+    switch (opcode) {
+        case OP_QUOTE:
+            return expr;
+        case OP_SET: {
+            if (argc < 2) return expr;
+            SExpr* rest = optimizeList(args->cdr, scope);
+            return rest == args->cdr ? expr : cons(head, cons(args->car, rest));
+        }
+        case OP_LAMBDA: {
+            if (argc < 2 || !isParamList(args->car)) return expr;
+            Scope inner = { args->car, scope };
+            SExpr* body = optimizeExpr(args->cdr->car, &inner);
+            return body == args->cdr->car ? expr : cons(head, cons(args->car, cons(body, args->cdr->cdr)));
+        }
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+        case OP_GT: case OP_LT: case OP_GE: case OP_LE: case OP_EQ: {
+            int arithmetic = opcode == OP_ADD || opcode == OP_SUB || opcode == OP_MUL || opcode == OP_DIV;
+            if (argc < 0 || (!arithmetic && argc != 2)) break;
+            SExpr* operands = optimizeList(args, scope);
+            SExpr* value = allConstant(operands, scope) ? foldPure(head, operands) : NULL;
+            if (value) return value;
+            return operands == args ? expr : cons(head, operands);
+        }
+        case OP_IF: {
+            if (argc != 3) break;
+            SExpr* condition = optimizeExpr(args->car, scope);
+            if (isConstant(condition, scope)) {
+                return optimizeExpr(isTruthy(constantValue(condition)) ? args->cdr->car : args->cdr->cdr->car, scope);
+            }
+            SExpr* branches = optimizeList(args->cdr, scope);
+            return condition == args->car && branches == args->cdr ? expr : cons(head, cons(condition, branches));
+        }
+        case OP_AND: case OP_OR: {
+            if (argc != 2) break;
+            SExpr* first = optimizeExpr(args->car, scope);
+            if (isConstant(first, scope)) {
+                int truthy = isTruthy(constantValue(first));
+                if (opcode == OP_AND) return truthy ? optimizeExpr(args->cdr->car, scope) : nil;
+                return truthy ? first : optimizeExpr(args->cdr->car, scope);
+            }
+            SExpr* rest = optimizeList(args->cdr, scope);
+            return first == args->car && rest == args->cdr ? expr : cons(head, cons(first, rest));
+        }
+        case OP_COND: {
+            // A clause's result doubles as the clause list tried after it, as in evalCond()
+            SExpr* clauses = args;
+            while (typeOf(clauses) == CONS && typeOf(clauses->car) == CONS &&
+                    clauses->car->car != nil && clauses->car->cdr != nil) {
+                SExpr* condition = optimizeExpr(clauses->car->car, scope);
+                if (!isConstant(condition, scope)) {
+                    if (condition != clauses->car->car) clauses = cons(cons(condition, clauses->car->cdr), clauses->cdr);
+                    break;
+                }
+                if (constantValue(condition) != nil) return optimizeExpr(clauses->car->cdr, scope);
+                clauses = clauses->car->cdr;
+            }
+            if (clauses == nil) return nil;
+            return clauses == args ? expr : cons(head, clauses);
+        }
+    }
+    return optimizeList(expr, scope);
+}
+
+// Nodes in a tree: every cons cell and every atom but the nil ending a list
+size_t countNodes(SExpr* expr) {
+    size_t count = 0;
+    for (; typeOf(expr) == CONS; expr = expr->cdr) count += 1 + countNodes(expr->car);
+    return count + (expr != nil);
+}
+
+// Returns the optimized form, adding the number of nodes it lost to *eliminated
+SExpr* optimize(SExpr* expr, size_t* eliminated) {
+    SExpr* result = optimizeExpr(expr, NULL);
+    if (result != expr && eliminated) {
+        size_t before = countNodes(expr), after = countNodes(result);
+        if (after < before) *eliminated += before - after;
+    }
+    return result;
+}
+
+// Bytecode: compile() flattens an expression into a linear instruction stream
+// that execute() runs on a small stack machine, so hot expressions are dispatched
+// once at compile time instead of re-walking CONS cells on every evaluation.
+// Forms the compiler does not specialise fall back to INS_EVAL of the subtree.
+enum {
+    INS_CONST, INS_NIL, INS_TRUE, INS_LOAD_GLOBAL, INS_SET_GLOBAL,
+    INS_ADD, INS_SUB, INS_MUL, INS_DIV, INS_GT, INS_LT, INS_GE, INS_LE, INS_EQ,
+    INS_JUMP, INS_JUMP_IF_FALSE, INS_JUMP_IF_TRUE, INS_DUP, INS_POP,
+    INS_PROC_OR_NIL, INS_CALL, INS_EVAL, INS_RETURN
+};
+
+typedef struct Chunk {
+    int* code;          // Opcodes, each followed by its operand if it has one
+    int length, capacity;
+    SExpr** constants;
+    int constantCount, constantCapacity;
+    GlobalCache* globals;   // One per INS_LOAD_GLOBAL site
+    int globalCount, globalCapacity;
+    int depth, maxDepth; // Operand stack depth, tracked while compiling
+} Chunk;
+
+void markConstants(Chunk* chunk) {
+    for (int i = 0; i < chunk->constantCount; i++) markCell(chunk->constants[i]);
+}
+
+void freeChunk(Chunk* chunk) {
+    free(chunk->code);
+    free(chunk->constants);
+    free(chunk->globals);
+    free(chunk);
+}
+
+int emit(Chunk* chunk, int word) {
+    if (chunk->length == chunk->capacity) {
+        chunk->capacity = chunk->capacity ? chunk->capacity * 2 : 32;
+        chunk->code = realloc(chunk->code, chunk->capacity * sizeof(int));
+        if (!chunk->code) {
+            printf("Memory allocation failed for bytecode\n");
+            exit(1);
+        }
+    }
+    chunk->code[chunk->length] = word;
+    return chunk->length++;
+}
+
+// Tracks how far an instruction moves the operand stack so execute() can size it up front
+void emitOp(Chunk* chunk, int op, int stackEffect) {
+    emit(chunk, op);
+    chunk->depth += stackEffect;
+    if (chunk->depth > chunk->maxDepth) chunk->maxDepth = chunk->depth;
+}
+
+int addConstant(Chunk* chunk, SExpr* value) {
+    if (chunk->constantCount == chunk->constantCapacity) {
+        chunk->constantCapacity = chunk->constantCapacity ? chunk->constantCapacity * 2 : 8;
+        chunk->constants = realloc(chunk->constants, chunk->constantCapacity * sizeof(SExpr*));
+        if (!chunk->constants) {
+            printf("Memory allocation failed for bytecode constants\n");
+            exit(1);
+        }
+    }
+    // Code lives on the collected heap, so its constants must too
+    chunk->constants[chunk->constantCount] = promote(value);
+    return chunk->constantCount++;
+}
+
+// Global names are interned symbols, which live outside the heap, so the caches need no marking
+void emitLoadGlobal(Chunk* chunk, SExpr* name) {
+    if (chunk->globalCount == chunk->globalCapacity) {
+        chunk->globalCapacity = chunk->globalCapacity ? chunk->globalCapacity * 2 : 8;
+        chunk->globals = realloc(chunk->globals, chunk->globalCapacity * sizeof(GlobalCache));
+        if (!chunk->globals) {
+            printf("Memory allocation failed for bytecode globals\n");
+            exit(1);
+        }
+    }
+    initGlobalCache(&chunk->globals[chunk->globalCount], name);
+    emitOp(chunk, INS_LOAD_GLOBAL, 1);
+    emit(chunk, chunk->globalCount++);
+}
+
+void emitConstant(Chunk* chunk, int op, SExpr* value, int stackEffect) {
+    emitOp(chunk, op, stackEffect);
+    emit(chunk, addConstant(chunk, value));
+}
+
+// Emits a forward jump and returns the operand slot to patch
+int emitJump(Chunk* chunk, int op, int stackEffect) {
+    emitOp(chunk, op, stackEffect);
+    return emit(chunk, -1);
+}
+
+void patchJump(Chunk* chunk, int slot) {
+    chunk->code[slot] = chunk->length;
+}
+
+// Number of proper-list elements, or -1 if args is not a proper list
+int listLength(SExpr* args) {
+    int n = 0;
+    while (typeOf(args) == CONS) {
+        n++;
+        args = args->cdr;
+    }
+    return args == nil ? n : -1;
+}
+
+void compileExpr(Chunk* chunk, SExpr* expr) {
+    int type = typeOf(expr);
+    if (expr == nil) {
+        emitOp(chunk, INS_NIL, 1);
+        return;
+    }
+    if (type == SYMBOL) {
+        if (expr == truth) emitOp(chunk, INS_TRUE, 1);
+        else emitLoadGlobal(chunk, expr);
+        return;
+    }
+    if (type == GLOBAL) {
+        emitLoadGlobal(chunk, expr->global.name);
+        return;
+    }
+    if (type != CONS) {
+        emitConstant(chunk, type == NUMBER || type == NIL || type == BIGNUM || type == FLOAT ? INS_CONST : INS_EVAL, expr, 1);
+        return;
+    }
+
+    SExpr* function = expr->car;
+    SExpr* args = expr->cdr;
+    int argc = listLength(args);
+    int opcode = typeOf(function) == SYMBOL ? function->opcode : OP_NONE;
+    static const int binary[] = {
+        [OP_ADD] = INS_ADD, [OP_SUB] = INS_SUB, [OP_MUL] = INS_MUL, [OP_DIV] = INS_DIV,
+        [OP_GT] = INS_GT, [OP_LT] = INS_LT, [OP_GE] = INS_GE, [OP_LE] = INS_LE, [OP_EQ] = INS_EQ,
+    };
+
+    switch (opcode) {
+        case OP_QUOTE:
+            if (argc < 1) break;
+            emitConstant(chunk, INS_CONST, args->car, 1);
+            return;
+        case OP_SET:
+            if (argc < 2 || typeOf(args->car) != SYMBOL) break;
+            compileExpr(chunk, args->cdr->car);
+            emitConstant(chunk, INS_SET_GLOBAL, args->car, 0);
+            return;
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+            // Operands go on the stack and one instruction folds them all
+            if (argc < 1) break;
+            for (SExpr* arg = args; arg != nil; arg = arg->cdr) compileExpr(chunk, arg->car);
+            emitOp(chunk, binary[opcode], 1 - argc);
+            emit(chunk, argc);
+            return;
+        case OP_GT: case OP_LT: case OP_GE: case OP_LE: case OP_EQ:
+            if (argc != 2) break;
+            compileExpr(chunk, args->car);
+            compileExpr(chunk, args->cdr->car);
+            emitOp(chunk, binary[opcode], -1);
+            return;
+        case OP_AND: {
+            if (argc != 2) break;
+            compileExpr(chunk, args->car);
+            int toFalse = emitJump(chunk, INS_JUMP_IF_FALSE, -1);
+            compileExpr(chunk, args->cdr->car);
+            int toEnd = emitJump(chunk, INS_JUMP, -1);
+            patchJump(chunk, toFalse);
+            emitOp(chunk, INS_NIL, 1);
+            patchJump(chunk, toEnd);
+            return;
+        }
+        case OP_OR: {
+            if (argc != 2) break;
+            compileExpr(chunk, args->car);
+            emitOp(chunk, INS_DUP, 1);
+            int toEnd = emitJump(chunk, INS_JUMP_IF_TRUE, -1);
+            emitOp(chunk, INS_POP, -1);
+            compileExpr(chunk, args->cdr->car);
+            patchJump(chunk, toEnd);
+            return;
+        }
+        case OP_NONE: {
+            // Application of a closure: head, then arguments, then the call
+            if (argc < 0) break;
+            compileExpr(chunk, function);
+            int toEnd = emitJump(chunk, INS_PROC_OR_NIL, 0);
+            for (SExpr* arg = args; arg != nil; arg = arg->cdr) compileExpr(chunk, arg->car);
+            emitOp(chunk, INS_CALL, -argc);
+            emit(chunk, argc);
+            patchJump(chunk, toEnd);
+            return;
+        }
+        case OP_IF: {
+            if (argc != 3) break;
+            compileExpr(chunk, args->car);
+            int toElse = emitJump(chunk, INS_JUMP_IF_FALSE, -1);
+            compileExpr(chunk, args->cdr->car);
+            int toEnd = emitJump(chunk, INS_JUMP, -1);
+            patchJump(chunk, toElse);
+            compileExpr(chunk, args->cdr->cdr->car);
+            patchJump(chunk, toEnd);
+            return;
+        }
+    }
+    // cond, lambda and anything malformed keep their tree-walking semantics
+    emitConstant(chunk, INS_EVAL, expr, 1);
+}
+
+SExpr* compile(SExpr* expr) {
+    Chunk* chunk = calloc(1, sizeof(Chunk));
+    if (!chunk) {
+        printf("Memory allocation failed for bytecode\n");
+        exit(1);
+    }
+    if (interp->optimize) expr = optimize(expr, &interp->nodesEliminated);
+    compileExpr(chunk, expr);
+    emitOp(chunk, INS_RETURN, -1);
+
+    // Always on the collected heap: the sweep frees the chunk with it
+    SExpr* code = heapAlloc(&interp->heap);
+    code->type = CODE;
+    code->chunk = chunk;
+    return code;
+}
+
+SExpr* execute(SExpr* code) {
+    Chunk* chunk = code->chunk;
+    int* ip = chunk->code;
+    SExpr** constants = chunk->constants;
+    GlobalCache* globals = chunk->globals;
+    // The operand stack is on the C stack, so the collector sees it. Slot 0 holds
+    // the code object itself so it can't be collected while it is running.
+    SExpr* stack[chunk->maxDepth + 2];
+    stack[0] = code;
+    SExpr** sp = stack + 1;
+    SExpr *a, *b;
+
+#if defined(__GNUC__)
+    // Direct threading: each handler jumps straight to the next one
+    static void* handlers[] = {
+        &&do_INS_CONST, &&do_INS_NIL, &&do_INS_TRUE, &&do_INS_LOAD_GLOBAL, &&do_INS_SET_GLOBAL,
+        &&do_INS_ADD, &&do_INS_SUB, &&do_INS_MUL, &&do_INS_DIV, &&do_INS_GT, &&do_INS_LT, &&do_INS_GE, &&do_INS_LE, &&do_INS_EQ,
+        &&do_INS_JUMP, &&do_INS_JUMP_IF_FALSE, &&do_INS_JUMP_IF_TRUE, &&do_INS_DUP, &&do_INS_POP,
+        &&do_INS_PROC_OR_NIL, &&do_INS_CALL, &&do_INS_EVAL, &&do_INS_RETURN
+    };
+#define NEXT goto *handlers[*ip++]
+#define OPCODE(op) do_##op:
+    NEXT;
+#else
+#define NEXT continue
+#define OPCODE(op) case op:
+    for (;;) switch (*ip++) {
+#endif
+    OPCODE(INS_CONST)
+        *sp++ = constants[*ip++];
+        NEXT;
+    OPCODE(INS_NIL)
+        *sp++ = nil;
+        NEXT;
+    OPCODE(INS_TRUE)
+        *sp++ = truth;
+        NEXT;
+    OPCODE(INS_LOAD_GLOBAL)
+        *sp++ = cachedGet(&globals[*ip++]);
+        NEXT;
+    OPCODE(INS_SET_GLOBAL)
+        a = sp[-1];
+        if (a == nil) sp[-1] = makeError("SET: Error evaluating value");
+        else set(constants[*ip], a);
+        ip++;
+        NEXT;
+    OPCODE(INS_ADD)
+        sp -= *ip;
+        *sp = foldArithmetic(OP_ADD, sp, *ip++);
+        sp++;
+        NEXT;
+    OPCODE(INS_SUB)
+        sp -= *ip;
+        *sp = foldArithmetic(OP_SUB, sp, *ip++);
+        sp++;
+        NEXT;
+    OPCODE(INS_MUL)
+        sp -= *ip;
+        *sp = foldArithmetic(OP_MUL, sp, *ip++);
+        sp++;
+        NEXT;
+    OPCODE(INS_DIV)
+        sp -= *ip;
+        *sp = foldArithmetic(OP_DIV, sp, *ip++);
+        sp++;
+        NEXT;
+    OPCODE(INS_GT)
+        b = *--sp;
+        sp[-1] = compareOperands(OP_GT, sp[-1], b);
+        NEXT;
+    OPCODE(INS_LT)
+        b = *--sp;
+        sp[-1] = compareOperands(OP_LT, sp[-1], b);
+        NEXT;
+    OPCODE(INS_GE)
+        b = *--sp;
+        sp[-1] = compareOperands(OP_GE, sp[-1], b);
+        NEXT;
+    OPCODE(INS_LE)
+        b = *--sp;
+        sp[-1] = compareOperands(OP_LE, sp[-1], b);
+        NEXT;
+    OPCODE(INS_EQ)
+        b = *--sp;
+        sp[-1] = eq(sp[-1], b);
+        NEXT;
+    OPCODE(INS_JUMP)
+        ip = chunk->code + *ip;
+        NEXT;
+    OPCODE(INS_JUMP_IF_FALSE)
+        a = *--sp;
+        ip = isTruthy(a) ? ip + 1 : chunk->code + *ip;
+        NEXT;
+    OPCODE(INS_JUMP_IF_TRUE)
+        a = *--sp;
+        ip = isTruthy(a) ? chunk->code + *ip : ip + 1;
+        NEXT;
+    OPCODE(INS_DUP)
+        a = sp[-1];
+        *sp++ = a;
+        NEXT;
+    OPCODE(INS_POP)
+        sp--;
+        NEXT;
+    OPCODE(INS_PROC_OR_NIL)
+        // A head that isn't a closure makes the whole call nil, arguments unevaluated
+        if (typeOf(sp[-1]) == LAMBDA) ip++;
+        else {
+            sp[-1] = nil;
+            ip = chunk->code + *ip;
+        }
+        NEXT;
+    OPCODE(INS_CALL)
+        // Arguments stay in their stack slots, where the collector can see them
+        sp -= *ip;
+        sp[-1] = apply(sp[-1], sp, *ip++);
+        NEXT;
+    OPCODE(INS_EVAL)
+        *sp++ = eval(constants[*ip++]);
+        NEXT;
+    OPCODE(INS_RETURN)
+        return sp[-1];
+#if !defined(__GNUC__)
+    }
+#endif
+#undef NEXT
+#undef OPCODE
+}
+
+// Evaluates one top-level form with its temporaries in the scratch arena and
+// releases them in bulk afterwards. The result is promoted so callers can keep it.
+// With hash-consing enabled the form is first rebuilt from shared heap cells,
+// and with the optimizer enabled it is optimized, in the same arena.
+SExpr* evalTopLevel(SExpr* expr) {
+    if (allocator == &interp->scratchAllocator) return eval(expr);
+    allocator = &interp->scratchAllocator;
+    if (interp->hashCons) expr = shareTree(expr);
+    if (interp->optimize) expr = optimize(expr, &interp->nodesEliminated);
+    SExpr* result = eval(expr);
+    allocator = &interp->heapAllocator;
+    result = promote(result);
+    arenaReset(&interp->scratchArena);
+    return result;
+}
+
+// Shortest of %.15g and %.17g that reads back exactly, always marked as a float
+void formatFloat(char* text, double value) {
+    sprintf(text, "%.15g", value);
+    if (strtod(text, NULL) != value) sprintf(text, "%.17g", value);
+    if (!strpbrk(text, ".eni")) strcat(text, ".0");
+}
+
+// Growable text buffer the printer writes into. With a flush callback it acts as
+// an output buffer instead: once PRINT_CHUNK bytes are pending they are handed
+// to the sink in one write and the buffer is reused.
+#define PRINT_CHUNK (64 * 1024)
+
+typedef struct StringBuilder {
+    char* data;
+    size_t length, capacity;
+    void (*flush)(struct StringBuilder* sb);    // NULL to keep everything in memory
+    void* sink;
+} StringBuilder;
+
+void sbReserve(StringBuilder* sb, size_t extra) {
+    if (sb->length + extra <= sb->capacity) return;
+    size_t capacity = sb->capacity ? sb->capacity : 256;
+    while (capacity < sb->length + extra) capacity *= 2;
+    sb->data = realloc(sb->data, capacity);
+    if (!sb->data) {
+        printf("Memory allocation failed for string builder\n");
+        exit(1);
+    }
+    sb->capacity = capacity;
+}
+
+void sbAppend(StringBuilder* sb, const char* text, size_t length) {
+    if (sb->flush && sb->length + length > sb->capacity) {
+        if (sb->length) sb->flush(sb);
+        sb->length = 0;
+        if (length > sb->capacity) {
+            // Too big to buffer (a huge bignum, say): pass it straight through
+            StringBuilder direct = *sb;
+            direct.data = (char*)text;
+            direct.length = length;
+            sb->flush(&direct);
+            return;
+        }
+    }
+    sbReserve(sb, length);
+    memcpy(sb->data + sb->length, text, length);
+    sb->length += length;
+}
+
+void sbAppendString(StringBuilder* sb, const char* text) {
+    sbAppend(sb, text, strlen(text));
+}
+
+void sbFree(StringBuilder* sb) {
+    free(sb->data);
+    sb->data = NULL;
+    sb->length = sb->capacity = 0;
+}
+
+void flushToStream(StringBuilder* sb) {
+    fwrite(sb->data, 1, sb->length, (FILE*)sb->sink);
+}
+
+void flushToFd(StringBuilder* sb) {
+    int fd = *(int*)sb->sink;
+    for (size_t done = 0; done < sb->length;) {
+#ifdef _WIN32
+        int n = _write(fd, sb->data + done, (unsigned int)(sb->length - done));
+#else
+        ssize_t n = write(fd, sb->data + done, sb->length - done);
+#endif
+        if (n <= 0) return;
+        done += n;
+    }
+}
+
+static const char digitPairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// Decimal digits of value, two at a time from the right. text needs room for 21 bytes; returns the length.
+size_t formatInteger(char* text, long long value) {
+    char digits[24];
+    char* p = digits + sizeof(digits);
+    unsigned long long magnitude = value < 0 ? 0 - (unsigned long long)value : (unsigned long long)value;
+    while (magnitude >= 100) {
+        unsigned int pair = (unsigned int)(magnitude % 100) * 2;
+        magnitude /= 100;
+        *--p = digitPairs[pair + 1];
+        *--p = digitPairs[pair];
+    }
+    if (magnitude >= 10) {
+        *--p = digitPairs[magnitude * 2 + 1];
+        *--p = digitPairs[magnitude * 2];
+    } else {
+        *--p = (char)('0' + magnitude);
+    }
+    if (value < 0) *--p = '-';
+    size_t length = digits + sizeof(digits) - p;
+    memcpy(text, p, length);
+    return length;
+}
+
+void buildAtom(StringBuilder* sb, SExpr* expr) {
+    char text[32];
+    switch (typeOf(expr)) {
+        case SYMBOL:
+            sbAppendString(sb, expr->symbol);
+            break;
+
+        case NUMBER:
+            sbAppend(sb, text, formatInteger(text, numberOf(expr)));
+            break;
+
+        case FLOAT:
+            formatFloat(text, expr->real);
+            sbAppendString(sb, text);
+            break;
+
+        case VECTOR:
+            sbAppend(sb, "#(", 2);
+            for (int i = 0; i < expr->length; i++) {
+                if (i) sbAppend(sb, " ", 1);
+                formatFloat(text, expr->elements[i]);
+                sbAppendString(sb, text);
+            }
+            sbAppend(sb, ")", 1);
+            break;
+
+        case BIGNUM: {
+            char* digits = bignumToString(expr);
+            sbAppendString(sb, digits);
+            free(digits);
+            break;
+        }
+
+        case NIL:
+            sbAppend(sb, "nil", 3);
+            break;
+
+        case CODE:
+            sbAppendString(sb, "#<code>");
+            break;
+
+        case LAMBDA:
+            sbAppendString(sb, "#<lambda>");
+            break;
+
+        case FRAME:
+            sbAppendString(sb, "#<frame>");
+            break;
+
+        default:
+            sbAppendString(sb, "Unknown");
+            break;
+    }
+}
+
+// Serializes expr without recursing: the stack holds, for every list still
+// open, the part of it that hasn't been printed yet. Nesting depth is bounded
+// only by memory.
+void buildSExpr(StringBuilder* sb, SExpr* expr) {
+    SExpr* inlineStack[64];
+    SExpr** stack = inlineStack;
+    size_t depth = 0, capacity = 64;
+    for (;;) {
+        if (expr != NULL && expr != nil && typeOf(expr) == LOCAL) expr = expr->localName;
+        else if (expr != NULL && expr != nil && typeOf(expr) == GLOBAL) expr = expr->global.name;
+        if (expr == NULL || expr == nil) {
+            sbAppend(sb, "nil", 3);
+        } else if (typeOf(expr) == CONS) {
+            if (depth == capacity) {
+                capacity *= 2;
+                SExpr** grown = stack == inlineStack ? malloc(capacity * sizeof(SExpr*)) : realloc(stack, capacity * sizeof(SExpr*));
+                if (!grown) {
+                    printf("Memory allocation failed for printer stack\n");
+                    exit(1);
+                }
+                if (stack == inlineStack) memcpy(grown, inlineStack, sizeof(inlineStack));
+                stack = grown;
+            }
+            sbAppend(sb, "(", 1);
+            stack[depth++] = expr->cdr;
+            expr = expr->car;
+            continue;
+        } else {
+            buildAtom(sb, expr);
+        }
+
+        // An element is done: move on to the next one of the innermost open list
+        for (;;) {
+            if (depth == 0) {
+                if (stack != inlineStack) free(stack);
+                return;
+            }
+            SExpr* rest = stack[depth - 1];
+            if (rest == NULL || rest == nil) {
+                sbAppend(sb, ")", 1);
+                depth--;
+            } else if (typeOf(rest) == CONS) {
+                sbAppend(sb, " ", 1);
+                stack[depth - 1] = rest->cdr;
+                expr = rest->car;
+                break;
+            } else {
+                sbAppend(sb, " . ", 3);  // Improper list tail
+                stack[depth - 1] = nil;
+                expr = rest;
+                break;
+            }
+        }
+    }
+}
+
+void writeSExpr(FILE* out, SExpr* expr) {
+    char buffer[PRINT_CHUNK];
+    StringBuilder sb = { buffer, 0, sizeof(buffer), flushToStream, out };
+    buildSExpr(&sb, expr);
+    flushToStream(&sb);
+}
+
+void writeSExprFd(int fd, SExpr* expr) {
+    char buffer[PRINT_CHUNK];
+    StringBuilder sb = { buffer, 0, sizeof(buffer), flushToFd, &fd };
+    buildSExpr(&sb, expr);
+    flushToFd(&sb);
+}
+
+// Returns the printed form as a malloc'd string for the caller to free
+char* sprintSExpr(SExpr* expr) {
+    StringBuilder sb = { NULL, 0, 0, NULL, NULL };
+    buildSExpr(&sb, expr);
+    sbAppend(&sb, "", 1);
+    return sb.data;
+}
+
+void printSExpr(SExpr* expr) {
+    writeSExpr(stdout, expr);
+}
+
+#ifdef LISP_SAMPLING
+int compareStrings(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Writes the samples taken so far as folded stacks, one line per distinct stack
+// with its count. Returns the number of samples written.
+long writeFoldedStacks(FILE* out) {
+    size_t used = atomic_load(&sampler.used);
+    if (used > SAMPLE_POOL_WORDS) used = SAMPLE_POOL_WORDS;
+    size_t count = 0, capacity = 1024;
+    char** stacks = malloc(capacity * sizeof(char*));
+    if (!stacks) return 0;
+    for (size_t at = 0; at + 2 <= used && at + 2 + sampler.pool[at] <= used; at += 2 + sampler.pool[at]) {
+        StringBuilder line = { NULL, 0, 0, NULL, NULL };
+        int frames = (int)sampler.pool[at];
+        if (sampler.pool[at + 1]) sbAppendString(&line, "(truncated);");
+        if (frames == 0) sbAppendString(&line, "(toplevel)");
+        for (int i = 0; i < frames; i++) {
+            SExpr* name = (SExpr*)sampler.pool[at + 2 + i];
+            if (i) sbAppend(&line, ";", 1);
+            sbAppendString(&line, name ? name->symbol : "(lambda)");
+        }
+        sbAppend(&line, "", 1);
+        if (count == capacity) {
+            char** grown = realloc(stacks, capacity * 2 * sizeof(char*));
+            if (!grown) {
+                sbFree(&line);
+                break;
+            }
+            stacks = grown;
+            capacity *= 2;
+        }
+        stacks[count++] = line.data;
+    }
+    qsort(stacks, count, sizeof(char*), compareStrings);
+    for (size_t i = 0, run; i < count; i += run) {
+        for (run = 1; i + run < count && strcmp(stacks[i], stacks[i + run]) == 0; run++) {}
+        fprintf(out, "%s %zu\n", stacks[i], run);
+    }
+    long dropped = atomic_load(&sampler.dropped);
+    if (dropped) fprintf(stderr, "Sampling: %ld samples dropped, the pool was full\n", dropped);
+    for (size_t i = 0; i < count; i++) free(stacks[i]);
+    free(stacks);
+    fflush(out);
+    return (long)count;
+}
+#endif
+
+// Reader: tokenizes S-expression text from a buffer, a memory-mapped file or a
+// FILE* stream and builds SExprs with a recursive-descent parser. Streams are
+// pulled in fixed-size chunks, so input size is unbounded. Tokens are spans of
+// the buffer; only a token straddling two stream chunks is copied.
+#define READ_CHUNK (64 * 1024)
+
+typedef struct Reader {
+    FILE* stream;       // NULL when reading a buffer or mapped file
+    size_t mapped;      // Length of a mapping owned by the reader, 0 otherwise
+    int ownsBuffer;     // buffer was malloc'd by the reader
+    char* buffer;
+    size_t length;      // Valid bytes in buffer
+    size_t pos;
+    int line;
+    char* token;        // Current token text, grown as needed
+    size_t tokenCapacity;
+    char* error;        // Set when the input is malformed
+    int lineMode;       // Refill a line at a time, for interactive input
+    char* prompt;       // Printed before the next refill, then replaced by continuation
+    char* continuation;
+} Reader;
+
+void initBufferReader(Reader* r, char* text, size_t length) {
+    r->stream = NULL;
+    r->mapped = 0;
+    r->ownsBuffer = 0;
+    r->buffer = text;
+    r->length = length;
+    r->pos = 0;
+    r->line = 1;
+    r->token = NULL;
+    r->tokenCapacity = 0;
+    r->error = NULL;
+    r->lineMode = 0;
+    r->prompt = r->continuation = NULL;
+}
+
+void initStreamReader(Reader* r, FILE* stream) {
+    initBufferReader(r, malloc(READ_CHUNK), 0);
+    if (!r->buffer) {
+        printf("Memory allocation failed for reader buffer\n");
+        exit(1);
+    }
+    r->stream = stream;
+    r->ownsBuffer = 1;
+}
+
+// A stream reader that never blocks for more than the current line
+void initLineReader(Reader* r, FILE* stream) {
+    initStreamReader(r, stream);
+    r->lineMode = 1;
+}
+
+// Maps a whole script read-only and reads it in place. Returns 0 if the file can't be opened.
+int initFileReader(Reader* r, char* path) {
+#ifdef _WIN32
+    // No mmap: fall back to one read into a private buffer
+    FILE* file = fopen(path, "rb");
+    if (!file) return 0;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+    char* text = malloc(size > 0 ? size : 1);
+    if (!text || fread(text, 1, size, file) != (size_t)size) {
+        free(text);
+        fclose(file);
+        return 0;
+    }
+    fclose(file);
+    initBufferReader(r, text, size);
+    r->ownsBuffer = 1;
+    return 1;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat info;
+    if (fstat(fd, &info) < 0) {
+        close(fd);
+        return 0;
+    }
+    if (info.st_size == 0) {
+        close(fd);
+        initBufferReader(r, "", 0);
+        return 1;
+    }
+    char* text = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (text == MAP_FAILED) return 0;
+    madvise(text, info.st_size, MADV_SEQUENTIAL);
+    initBufferReader(r, text, info.st_size);
+    r->mapped = info.st_size;
+    return 1;
+#endif
+}
+
+void freeReader(Reader* r) {
+#ifndef _WIN32
+    if (r->mapped) munmap(r->buffer, r->mapped);
+#endif
+    if (r->ownsBuffer) free(r->buffer);
+    free(r->token);
+    r->buffer = r->token = NULL;
+}
+
+// Returns the next character without consuming it, or EOF
+int peekChar(Reader* r) {
+    if (r->pos < r->length) return (unsigned char)r->buffer[r->pos];
+    if (!r->stream) return EOF;
+    if (r->prompt) {
+        fputs(r->prompt, stdout);
+        fflush(stdout);
+        r->prompt = r->continuation;
+    }
+    if (r->lineMode) r->length = fgets(r->buffer, READ_CHUNK, r->stream) ? strlen(r->buffer) : 0;
+    else r->length = fread(r->buffer, 1, READ_CHUNK, r->stream);
+    r->pos = 0;
+    return r->length ? (unsigned char)r->buffer[0] : EOF;
+}
+
+void skipSpace(Reader* r) {
+    for (;;) {
+        int c = peekChar(r);
+        if (c == ';') {
+            while (c != EOF && c != '\n') {
+                r->pos++;
+                c = peekChar(r);
+            }
+        } else if (c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f' || c == '\v') {
+            if (c == '\n') r->line++;
+            r->pos++;
+        } else {
+            return;
+        }
+    }
+}
+
+int isDelimiter(int c) {
+    return c == EOF || c == '(' || c == ')' || c == '\'' || c == ';' ||
+        c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f' || c == '\v';
+}
+
+// Returns an atom's characters as a span. It points into the input unless the
+// token straddles two stream chunks, in which case it is gathered in r->token.
+char* readToken(Reader* r, size_t* tokenLength) {
+    size_t start = r->pos;
+    while (r->pos < r->length && !isDelimiter((unsigned char)r->buffer[r->pos])) r->pos++;
+    if (r->pos < r->length || !r->stream) {
+        *tokenLength = r->pos - start;
+        return r->buffer + start;
+    }
+    r->pos = start;
+
+    size_t length = 0;
+    for (;;) {
+        // Copy straight out of the buffer while we can, one chunk at a time
+        size_t start = r->pos;
+        while (r->pos < r->length && !isDelimiter((unsigned char)r->buffer[r->pos])) r->pos++;
+        size_t n = r->pos - start;
+        if (length + n + 1 > r->tokenCapacity) {
+            r->tokenCapacity = (length + n + 1) * 2;
+            r->token = realloc(r->token, r->tokenCapacity);
+            if (!r->token) {
+                printf("Memory allocation failed for reader token\n");
+                exit(1);
+            }
+        }
+        memcpy(r->token + length, r->buffer + start, n);
+        length += n;
+        if (r->pos < r->length || isDelimiter(peekChar(r))) break;
+    }
+    *tokenLength = length;
+    return r->token;
+}
+
+SExpr* parseAtom(char* text, size_t length) {
+    size_t sign = text[0] == '-' || text[0] == '+';
+    int numeric = length > sign;
+    unsigned long long magnitude = 0;
+    int overflow = 0;
+    for (size_t i = sign; i < length && numeric; i++) {
+        if (text[i] < '0' || text[i] > '9') numeric = 0;
+        else if (magnitude > (ULLONG_MAX - 9) / 10) overflow = 1;
+        else magnitude = magnitude * 10 + (text[i] - '0');
+    }
+    if (numeric) {
+        unsigned long long limit = text[0] == '-' ? (unsigned long long)LLONG_MAX + 1 : LLONG_MAX;
+        if (overflow || magnitude > limit) return parseInteger(text + sign, length - sign, text[0] == '-');
+        return makeNumber(text[0] == '-' ? (long long)(0 - magnitude) : (long long)magnitude);
+    }
+    // Floats need a digit and a point or exponent, and nothing strtod would take as hex, inf or nan
+    int floating = length < 64, marked = 0;
+    for (size_t i = 0; i < length && floating; i++) {
+        if (text[i] == '.' || text[i] == 'e' || text[i] == 'E') marked = 1;
+        else if ((text[i] < '0' || text[i] > '9') && text[i] != '+' && text[i] != '-') floating = 0;
+    }
+    if (floating && marked) {
+        char buffer[64];
+        memcpy(buffer, text, length);
+        buffer[length] = '\0';
+        char* end;
+        double value = strtod(buffer, &end);
+        if (end == buffer + length && strpbrk(buffer, "0123456789")) return makeFloat(value);
+    }
+    if (length == 3 && memcmp(text, "nil", 3) == 0) return nil;
+    return makeSymbolSpan(text, length);
+}
+
+// Returns the next datum, or NULL at end of input or on error (r->error is then set)
+SExpr* readSExpr(Reader* r) {
+    skipSpace(r);
+    int c = peekChar(r);
+    if (c == EOF) return NULL;
+    if (c == ')') {
+        r->error = "READ: Unexpected ')'";
+        return NULL;
+    }
+    if (c == '\'') {
+        r->pos++;
+        SExpr* quoted = readSExpr(r);
+        if (!quoted) {
+            if (!r->error) r->error = "READ: Missing datum after quote";
+            return NULL;
+        }
+        return cons(makeSymbol("quote"), cons(quoted, nil));
+    }
+    if (c != '(') {
+        size_t length;
+        char* token = readToken(r, &length);
+        return parseAtom(token, length);
+    }
+
+    // List: append to a tail pointer so siblings don't recurse
+    r->pos++;
+    SExpr* head = nil;
+    SExpr* tail = nil;
+    for (;;) {
+        skipSpace(r);
+        c = peekChar(r);
+        if (c == EOF) {
+            r->error = "READ: Unterminated list";
+            return NULL;
+        }
+        if (c == ')') {
+            r->pos++;
+            return head;
+        }
+        SExpr* item = readSExpr(r);
+        if (!item) {
+            if (!r->error) r->error = "READ: Unterminated list";
+            return NULL;
+        }
+        if (typeOf(item) == SYMBOL && item->symbol[0] == '.' && item->symbol[1] == '\0') {
+            // Dotted pair: exactly one datum then ')'
+            SExpr* rest = readSExpr(r);
+            skipSpace(r);
+            if (!rest || tail == nil || peekChar(r) != ')') {
+                if (!r->error) r->error = "READ: Malformed dotted pair";
+                return NULL;
+            }
+            r->pos++;
+            tail->cdr = rest;
+            return head;
+        }
+        SExpr* cell = cons(item, nil);
+        if (tail == nil) head = cell;
+        else tail->cdr = cell;
+        tail = cell;
+    }
+}
+
+// Parses the first datum in a string
+SExpr* parse(char* input) {
+    Reader r;
+    initBufferReader(&r, input, strlen(input));
+    SExpr* result = readSExpr(&r);
+    if (r.error) result = makeError(r.error);
+    freeReader(&r);
+    return result ? result : nil;
+}
+
+// Evaluates every remaining form and returns the last result
+SExpr* evalAll(Reader* r) {
+    SExpr* result = nil;
+    SExpr* form;
+    while ((form = readSExpr(r)) != NULL) result = evalTopLevel(form);
+    if (r->error) result = makeError(r->error);
+    freeReader(r);
+    return result;
+}
+
+// Evaluates every form in a script file and returns the last result
+SExpr* loadFile(char* path) {
+    Reader r;
+    if (!initFileReader(&r, path)) return makeError("LOAD: Cannot open file");
+    return evalAll(&r);
+}
+
+int isTerminal(FILE* stream) {
+#ifdef _WIN32
+    return _isatty(_fileno(stream));
+#else
+    return isatty(fileno(stream));
+#endif
+}
+
+// Cells allocated so far on the heap and in the scratch arena together
+size_t cellsAllocated() {
+    return interp->heap.stats.bytesAllocated / sizeof(SExpr) + interp->scratchArena.retired + interp->scratchArena.allocated;
+}
+
+// Read-eval-print loop over a stream. Forms may span lines: the reader pulls
+// another line whenever a form is still open. Each form is evaluated against the
+// persistent global environment and its scratch memory is released afterwards.
+void runRepl(FILE* in, FILE* out, int showStats) {
+    Reader r;
+    initLineReader(&r, in);
+    int terminal = isTerminal(in);
+    for (;;) {
+        if (terminal) {
+            r.prompt = "> ";
+            r.continuation = "  ";
+        }
+        SExpr* form = readSExpr(&r);
+        if (!form) {
+            if (!r.error) break;   // End of input
+            fprintf(out, "%s on line %d\n", r.error, r.line);
+            r.error = NULL;
+            r.pos = r.length;       // Drop the rest of the offending line
+            continue;
+        }
+        long long start = nowNanos();
+        size_t cellsBefore = cellsAllocated();
+        size_t eliminatedBefore = interp->nodesEliminated;
+        SExpr* result = evalTopLevel(form);
+        long long elapsed = nowNanos() - start;
+        writeSExpr(out, result);
+        fprintf(out, "\n");
+        if (showStats && interp->optimize) {
+            fprintf(out, "; %.3f ms, %zu cells allocated, %zu nodes eliminated\n", elapsed / 1e6,
+                cellsAllocated() - cellsBefore, interp->nodesEliminated - eliminatedBefore);
+        } else if (showStats) {
+            fprintf(out, "; %.3f ms, %zu cells allocated\n", elapsed / 1e6, cellsAllocated() - cellsBefore);
+        }
+        fflush(out);
+    }
+    if (terminal) fprintf(out, "\n");
+    freeReader(&r);
+}
+
+// Parallel evaluation: a run of top-level forms that don't mention set is spread
+// over a pool of workers, each popping form indices off its own Chase-Lev deque
+// and stealing from the others when it runs dry. A worker allocates only in its
+// own arena and prints each result to text before resetting it, so the
+// collected heap and the globals are only ever read while a run is in flight.
+// A form that still reaches set (through a closure, say) is abandoned along with
+// every form after it; the caller then evaluates it serially and carries on, so
+// results are exactly those of evaluating the forms one after another.
+int isPureForm(SExpr* expr) {
+    for (; typeOf(expr) == CONS; expr = expr->cdr) {
+        if (!isPureForm(expr->car)) return 0;
+    }
+    return typeOf(expr) != SYMBOL || expr->opcode != OP_SET;
+}
+
+#ifdef LISP_THREADS
+#define STEAL_RETRY -2
+#define WORKER_STACK (8 * 1024 * 1024)
+
+typedef struct Deque {
+    atomic_long top, bottom;
+    int* tasks;             // Filled before a run starts, never wraps
+} Deque;
+
+typedef struct Worker {
+    struct Scheduler* scheduler;
+    pthread_t thread;
+    Deque deque;
+    Arena arena;
+    Allocator allocator;
+    int task;               // Index of the form being evaluated
+    jmp_buf escape;
+} Worker;
+
+typedef struct Scheduler {
+    Interp* interp;         // Instance whose globals the workers read
+    Worker* workers;        // workers[0] is the calling thread
+    int workerCount;
+    SExpr** forms;          // The current run
+    char** results;         // Printed result of each form
+    atomic_int abortFrom;   // First form that reached set; later ones are discarded
+    pthread_mutex_t lock;
+    pthread_cond_t start, done;
+    int generation, busy, stopping;
+} Scheduler;
+
+void dequePush(Deque* d, int task) {
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    d->tasks[b] = task;
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_release);
+}
+
+// Owner end. Returns -1 when the deque is empty.
+int dequePop(Deque* d) {
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&d->top, memory_order_relaxed);
+    if (t > b) {
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+        return -1;
+    }
+    int task = d->tasks[b];
+    if (t == b) {
+        // Last task: race the thieves for it
+        if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) task = -1;
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    }
+    return task;
+}
+
+// Thief end. Returns -1 when empty, STEAL_RETRY when another thread won the race.
+int dequeSteal(Deque* d) {
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+    if (t >= b) return -1;
+    int task = d->tasks[t];
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) return STEAL_RETRY;
+    return task;
+}
+
+int stealTask(Worker* w) {
+    Scheduler* s = w->scheduler;
+    int self = (int)(w - s->workers);
+    for (;;) {
+        int contended = 0;
+        for (int i = 1; i < s->workerCount; i++) {
+            int task = dequeSteal(&s->workers[(self + i) % s->workerCount].deque);
+            if (task >= 0) return task;
+            if (task == STEAL_RETRY) contended = 1;
+        }
+        if (!contended) return -1;
+    }
+}
+
+// Leaves the current form: reason 1 when it reached set, 2 when an earlier form did
+void workerEscape(int reason) {
+    longjmp(currentWorker->escape, reason);
+}
+
+// Called on every procedure call, so a form made moot by an earlier set stops promptly
+void workerCheckpoint() {
+    if (currentWorker->task > atomic_load_explicit(&currentWorker->scheduler->abortFrom, memory_order_relaxed)) workerEscape(2);
+}
+
+void runTasks(Worker* w) {
+    Scheduler* s = w->scheduler;
+    Allocator* savedAllocator = allocator;
+    allocator = &w->allocator;
+    currentWorker = w;
+    for (;;) {
+        int task = dequePop(&w->deque);
+        if (task < 0) task = stealTask(w);
+        if (task < 0) break;
+        if (task > atomic_load(&s->abortFrom)) continue;
+        w->task = task;
+        int reason = setjmp(w->escape);
+        if (reason == 0) {
+            s->results[task] = sprintSExpr(eval(s->forms[task]));
+        } else {
+            currentFrame = NULL;
+            callStack.depth = 0;
+            int first = atomic_load(&s->abortFrom);
+            while (reason == 1 && task < first && !atomic_compare_exchange_weak(&s->abortFrom, &first, task)) {}
+        }
+        arenaReset(&w->arena);
+    }
+    currentWorker = NULL;
+    allocator = savedAllocator;
+}
+
+void* workerMain(void* context) {
+    Worker* w = (Worker*)context;
+    Scheduler* s = w->scheduler;
+    interp = s->interp;
+    int seen = 0;
+    for (;;) {
+        pthread_mutex_lock(&s->lock);
+        while (s->generation == seen && !s->stopping) pthread_cond_wait(&s->start, &s->lock);
+        int stopping = s->stopping;
+        seen = s->generation;
+        pthread_mutex_unlock(&s->lock);
+        if (stopping) return NULL;
+        runTasks(w);
+        pthread_mutex_lock(&s->lock);
+        if (--s->busy == 0) pthread_cond_signal(&s->done);
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+// Starts jobs - 1 threads; the caller works as the first one. Runs hold at most maxForms forms.
+Scheduler* createScheduler(int jobs, int maxForms) {
+    Scheduler* s = calloc(1, sizeof(Scheduler));
+    Worker* workers = s ? calloc(jobs, sizeof(Worker)) : NULL;
+    if (!workers) {
+        printf("Memory allocation failed for scheduler\n");
+        exit(1);
+    }
+    s->interp = interp;
+    s->workers = workers;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->start, NULL);
+    pthread_cond_init(&s->done, NULL);
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, WORKER_STACK);  // Deep recursion shouldn't depend on the platform default
+    atomic_fetch_add_explicit(&s->interp->sharers, 1, memory_order_relaxed);
+    for (int i = 0; i < jobs; i++) {
+        Worker* w = &workers[i];
+        w->scheduler = s;
+        w->deque.tasks = malloc(maxForms * sizeof(int));
+        if (!w->deque.tasks) {
+            printf("Memory allocation failed for scheduler\n");
+            exit(1);
+        }
+        w->allocator.alloc = arenaAlloc;
+        w->allocator.context = &w->arena;
+        if (i > 0 && pthread_create(&w->thread, &attributes, workerMain, w) != 0) {
+            free(w->deque.tasks);
+            break;
+        }
+        s->workerCount++;
+    }
+    pthread_attr_destroy(&attributes);
+    return s;
+}
+
+void destroyScheduler(Scheduler* s) {
+    pthread_mutex_lock(&s->lock);
+    s->stopping = 1;
+    pthread_cond_broadcast(&s->start);
+    pthread_mutex_unlock(&s->lock);
+    for (int i = 0; i < s->workerCount; i++) {
+        if (i > 0) pthread_join(s->workers[i].thread, NULL);
+        free(s->workers[i].deque.tasks);
+        arenaFree(&s->workers[i].arena);
+    }
+    atomic_fetch_sub_explicit(&s->interp->sharers, 1, memory_order_relaxed);
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->start);
+    pthread_cond_destroy(&s->done);
+    free(s->workers);
+    free(s);
+}
+
+// Evaluates pure forms in parallel, leaving each printed result (or NULL) in results.
+// Returns how many leading forms completed; the form at that index must be rerun serially.
+int runParallel(Scheduler* s, SExpr** forms, int count, char** results) {
+    s->forms = forms;
+    s->results = results;
+    atomic_store(&s->abortFrom, count);
+    for (int i = 0; i < count; i++) results[i] = NULL;
+    // Contiguous blocks, pushed last first so each owner works through its block in order
+    for (int w = 0; w < s->workerCount; w++) {
+        Deque* d = &s->workers[w].deque;
+        atomic_store(&d->top, 0);
+        atomic_store(&d->bottom, 0);
+        int first = (int)((long long)count * w / s->workerCount);
+        int last = (int)((long long)count * (w + 1) / s->workerCount);
+        for (int i = last - 1; i >= first; i--) dequePush(d, i);
+    }
+    interp->heap.inhibit++;     // The caller's stack isn't what the workers are holding on to
+    pthread_mutex_lock(&s->lock);
+    s->generation++;
+    s->busy = s->workerCount - 1;
+    pthread_cond_broadcast(&s->start);
+    pthread_mutex_unlock(&s->lock);
+    runTasks(&s->workers[0]);
+    pthread_mutex_lock(&s->lock);
+    while (s->busy > 0) pthread_cond_wait(&s->done, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+    interp->heap.inhibit--;
+    return atomic_load(&s->abortFrom);
+}
+#else
+typedef struct Scheduler Scheduler;
+#endif
+
+// Batch runner: a script is read, evaluated and printed by three stages joined by
+// queues. Forms travel in batches that own the arena their cells were read into,
+// so the reader thread never touches the collected heap and a batch is released
+// in one reset once evaluated. Only the main thread evaluates, so globals and the
+// heap stay single-threaded; the stages just overlap parsing and output with it.
+#define BATCH_FORMS 256
+#define BATCH_POOL 4
+
+typedef struct Batch {
+    Arena arena;            // Cells of the forms below
+    SExpr* forms[BATCH_FORMS];
+    int count;
+    char* error;            // Read error that ended the input, if any
+    int line;
+    StringBuilder output;   // Printed results, written out in one go
+} Batch;
+
+// A queue never holds more than the whole pool, so pushing never blocks
+typedef struct BatchQueue {
+    Batch* items[BATCH_POOL];
+    int head, count;
+    int closed;
+#ifdef LISP_THREADS
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+#endif
+} BatchQueue;
+
+typedef struct Pipeline {
+    Interp* interp;         // Instance the reader thread interns into
+    Reader reader;
+    FILE* out;
+    Scheduler* scheduler;   // NULL to evaluate on the main thread alone
+    Batch batches[BATCH_POOL];
+    BatchQueue free, parsed, printed;
+} Pipeline;
+
+void queueInit(BatchQueue* q) {
+    q->head = q->count = q->closed = 0;
+#ifdef LISP_THREADS
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->ready, NULL);
+#endif
+}
+
+void queueDestroy(BatchQueue* q) {
+#ifdef LISP_THREADS
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->ready);
+#endif
+}
+
+void queuePush(BatchQueue* q, Batch* batch) {
+    LOCK(q->lock);
+    q->items[(q->head + q->count++) % BATCH_POOL] = batch;
+#ifdef LISP_THREADS
+    pthread_cond_signal(&q->ready);
+#endif
+    UNLOCK(q->lock);
+}
+
+// No more batches will be pushed; wakes a consumer waiting on an empty queue
+void queueClose(BatchQueue* q) {
+    LOCK(q->lock);
+    q->closed = 1;
+#ifdef LISP_THREADS
+    pthread_cond_broadcast(&q->ready);
+#endif
+    UNLOCK(q->lock);
+}
+
+// Blocks until a batch is available. Returns NULL once the queue is closed and drained.
+Batch* queuePop(BatchQueue* q) {
+    LOCK(q->lock);
+#ifdef LISP_THREADS
+    while (q->count == 0 && !q->closed) pthread_cond_wait(&q->ready, &q->lock);
+#endif
+    Batch* batch = NULL;
+    if (q->count) {
+        batch = q->items[q->head];
+        q->head = (q->head + 1) % BATCH_POOL;
+        q->count--;
+    }
+    UNLOCK(q->lock);
+    return batch;
+}
+
+// Fills a batch with the next forms, allocating them in its arena. Returns 0 once the input is exhausted.
+int readBatch(Reader* r, Batch* batch) {
+    Allocator batchAllocator = { arenaAlloc, &batch->arena };
+    Allocator* saved = allocator;
+    allocator = &batchAllocator;
+    batch->count = 0;
+    while (batch->count < BATCH_FORMS) {
+        SExpr* form = readSExpr(r);
+        if (!form) break;
+        batch->forms[batch->count++] = form;
+    }
+    allocator = saved;
+    batch->error = r->error;
+    batch->line = r->line;
+    return batch->count == BATCH_FORMS && !r->error;
+}
+
+// Evaluates a batch in order and prints its results, then releases its forms.
+// With a scheduler, runs of pure forms are evaluated in parallel.
+void evalBatch(Batch* batch, Scheduler* scheduler) {
+    batch->output.length = 0;
+    interp->sourceArena = &batch->arena;
+    for (int i = 0; i < batch->count;) {
+#ifdef LISP_THREADS
+        int end = i;
+        while (scheduler && end < batch->count && isPureForm(batch->forms[end])) end++;
+        if (end - i >= 2) {
+            char* results[BATCH_FORMS];
+            int done = i + runParallel(scheduler, batch->forms + i, end - i, results);
+            for (int k = i; k < end; k++) {
+                if (k < done) {
+                    sbAppendString(&batch->output, results[k - i]);
+                    sbAppend(&batch->output, "\n", 1);
+                }
+                free(results[k - i]);
+            }
+            i = done;
+            if (i == end) continue;
+        }
+#endif
+        buildSExpr(&batch->output, evalTopLevel(batch->forms[i++]));
+        sbAppend(&batch->output, "\n", 1);
+    }
+    interp->sourceArena = NULL;
+    if (batch->error) {
+        char text[32];
+        sbAppendString(&batch->output, batch->error);
+        sbAppend(&batch->output, text, sprintf(text, " on line %d\n", batch->line));
+    }
+    arenaReset(&batch->arena);
+}
+
+void writeBatch(FILE* out, Batch* batch) {
+    fwrite(batch->output.data, 1, batch->output.length, out);
+}
+
+#ifdef LISP_THREADS
+void* readStage(void* context) {
+    Pipeline* p = (Pipeline*)context;
+    interp = p->interp;
+    int more = 1;
+    while (more) {
+        Batch* batch = queuePop(&p->free);
+        more = readBatch(&p->reader, batch);
+        queuePush(&p->parsed, batch);
+    }
+    queueClose(&p->parsed);
+    return NULL;
+}
+
+void* writeStage(void* context) {
+    Pipeline* p = (Pipeline*)context;
+    Batch* batch;
+    while ((batch = queuePop(&p->printed)) != NULL) {
+        writeBatch(p->out, batch);
+        queuePush(&p->free, batch);
+    }
+    return NULL;
+}
+#endif
+
+// Runs every form of a script (stdin when path is NULL) and prints each result on
+// its own line. Without threads the stages take turns on a single batch; jobs
+// above 1 also evaluates pure forms on that many threads.
+// Returns 0 if the script can't be opened.
+int runBatch(char* path, FILE* out, int threaded, int jobs) {
+    Pipeline* p = calloc(1, sizeof(Pipeline));
+    if (!p) {
+        printf("Memory allocation failed for batch pipeline\n");
+        exit(1);
+    }
+    if (path) {
+        if (!initFileReader(&p->reader, path)) {
+            free(p);
+            return 0;
+        }
+    } else {
+        initStreamReader(&p->reader, stdin);
+    }
+    p->out = out;
+    p->interp = interp;
+#ifdef LISP_THREADS
+    if (jobs > 1) p->scheduler = createScheduler(jobs, BATCH_FORMS);
+#endif
+
+    int pipelined = 0;
+#ifdef LISP_THREADS
+    if (threaded) {
+        queueInit(&p->free);
+        queueInit(&p->parsed);
+        queueInit(&p->printed);
+        for (int i = 0; i < BATCH_POOL; i++) queuePush(&p->free, &p->batches[i]);
+        pthread_t reader, writer;
+        atomic_fetch_add_explicit(&interp->sharers, 1, memory_order_relaxed);
+        pipelined = pthread_create(&reader, NULL, readStage, p) == 0;
+        int writing = pipelined && pthread_create(&writer, NULL, writeStage, p) == 0;
+        if (pipelined) {
+            Batch* batch;
+            while ((batch = queuePop(&p->parsed)) != NULL) {
+                evalBatch(batch, p->scheduler);
+                if (writing) {
+                    queuePush(&p->printed, batch);
+                } else {
+                    writeBatch(out, batch);
+                    queuePush(&p->free, batch);
+                }
+            }
+            queueClose(&p->printed);
+            pthread_join(reader, NULL);
+            if (writing) pthread_join(writer, NULL);
+        }
+        atomic_fetch_sub_explicit(&interp->sharers, 1, memory_order_relaxed);
+        queueDestroy(&p->free);
+        queueDestroy(&p->parsed);
+        queueDestroy(&p->printed);
+    }
+#endif
+    if (!pipelined) {
+        Batch* batch = &p->batches[0];
+        int more;
+        do {
+            more = readBatch(&p->reader, batch);
+            evalBatch(batch, p->scheduler);
+            writeBatch(out, batch);
+        } while (more);
+    }
+    fflush(out);
+
+#ifdef LISP_THREADS
+    if (p->scheduler) destroyScheduler(p->scheduler);
+#endif
+    freeReader(&p->reader);
+    for (int i = 0; i < BATCH_POOL; i++) {
+        arenaFree(&p->batches[i].arena);
+        sbFree(&p->batches[i].output);
+    }
+    free(p);
+    return 1;
+}
+
+// Embedding API. Each instance owns its globals, heap, symbol table and error
+// state, so threads that each use their own instance never contend. An instance
+// must only be used by one thread at a time, and its collector scans that
+// thread's stack: create it on the thread that will use it, passing a stack
+// address that outlives every call (as initGC does). Values returned stay valid
+// while that stack or a global of the same instance holds them, and must not be
+// handed to another instance.
+typedef struct InterpBinding {
+    Interp* interp;
+    Allocator* allocator;
+} InterpBinding;
+
+InterpBinding enterInterp(Interp* in) {
+    InterpBinding saved = { interp, allocator };
+    interp = in;
+    allocator = &in->heapAllocator;
+    return saved;
+}
+
+void leaveInterp(InterpBinding saved) {
+    interp = saved.interp;
+    allocator = saved.allocator;
+}
+
+Interp* lispCreate(void* stackBase) {
+    Interp* in = calloc(1, sizeof(Interp));
+    if (!in) return NULL;
+#ifdef LISP_THREADS
+    pthread_mutex_init(&in->symbolsLock, NULL);
+    pthread_mutex_init(&in->globals.writeLock, NULL);
+#endif
+    in->heap = (Heap)HEAP_DEFAULTS;
+    in->heap.stackBase = (char*)stackBase;
+    in->heapAllocator = (Allocator){ heapAlloc, &in->heap };
+    in->scratchAllocator = (Allocator){ arenaAlloc, &in->scratchArena };
+    InterpBinding saved = enterInterp(in);
+    initSymbols();
+    leaveInterp(saved);
+    return in;
+}
+
+// Frees an instance and everything it allocated. It must not be the one in use.
+void lispDestroy(Interp* in) {
+    InterpBinding saved = enterInterp(in);
+    Arena* cells = &in->heap.arena;
+    for (Slab* slab = cells->first; slab; slab = slab->next) {
+        char* end = slab == cells->current ? cells->next : slab->limit;
+        for (char* p = slab->cells; p < end; p += sizeof(SExpr)) {
+            if (((SExpr*)p)->type != FREE) releaseExternal((SExpr*)p);
+        }
+        if (slab == cells->current) break;
+    }
+    arenaFree(cells);
+    arenaFree(&in->scratchArena);
+    for (size_t i = 0; i < in->symbols.capacity; i++) {
+        SExpr* symbol = in->symbols.slots[i];
+        if (!symbol || symbol == truth) continue;
+        free(symbol->symbol);
+        free(symbol);
+    }
+    free(in->symbols.slots);
+    free(in->shared.slots);
+    EnvSlots* globals = LOAD_ACQUIRE(in->globals.table);
+    for (size_t i = 0; globals && i < globals->capacity; i++) free(LOAD_ACQUIRE(globals->slots[i]));
+    while (globals) {
+        EnvSlots* retired = globals->retired;
+        free(globals);
+        globals = retired;
+    }
+    free(in->markStack);
+    free(in->forwardFrom);
+    free(in->forwardTo);
+#ifdef LISP_THREADS
+    pthread_mutex_destroy(&in->symbolsLock);
+    pthread_mutex_destroy(&in->globals.writeLock);
+#endif
+    leaveInterp(saved);
+    free(in);
+}
+
+// Evaluates every form in source and returns the last result
+SExpr* lispEval(Interp* in, const char* source) {
+    InterpBinding saved = enterInterp(in);
+    in->error = NULL;
+    Reader r;
+    initBufferReader(&r, (char*)source, strlen(source));
+    SExpr* result = evalAll(&r);
+    leaveInterp(saved);
+    return result;
+}
+
+void lispSet(Interp* in, const char* name, SExpr* value) {
+    InterpBinding saved = enterInterp(in);
+    set(makeSymbolSpan(name, strlen(name)), value);
+    leaveInterp(saved);
+}
+
+SExpr* lispGet(Interp* in, const char* name) {
+    InterpBinding saved = enterInterp(in);
+    SExpr* value = get(makeSymbolSpan(name, strlen(name)));
+    leaveInterp(saved);
+    return value;
+}
+
+// Message of the first error value made by the last lispEval, or NULL
+const char* lispError(Interp* in) {
+    return in->error;
+}
+
+#ifdef LISP_THREADS
+// Shared environment traffic: readers look names up while a writer updates them.
+// Values are kept congruent to their name's index so a reader can check what it sees.
+typedef struct EnvTraffic {
+    Interp* interp;
+    SExpr** names;
+    int count;
+    SExpr** added;          // Bound by the writer while the readers run
+    int addedCount;
+    int rounds;             // Writer passes over names
+    long long pauseNs;      // Writer sleep between updates, 0 for none
+    long long quota;        // Lookups per reader, or 0 to read until the writer is done
+    ATOMIC(int) stop;
+    int readers;            // Reader threads the benchmark starts
+} EnvTraffic;
+
+typedef struct EnvReader {
+    EnvTraffic* traffic;
+    long long lookups;
+    int consistent;
+} EnvReader;
+
+void* envReaderMain(void* context) {
+    EnvReader* reader = (EnvReader*)context;
+    EnvTraffic* t = reader->traffic;
+    interp = t->interp;
+    reader->consistent = 1;
+    unsigned int pick = (unsigned int)(uintptr_t)reader;
+    while (!LOAD_ACQUIRE(t->stop) && (!t->quota || reader->lookups < t->quota)) {
+        for (int k = 0; k < 1024; k++) {
+            pick = pick * 1103515245u + 12345u;
+            int i = (pick >> 8) % t->count;
+            SExpr* value = get(t->names[i]);
+            if (!isFixnum(value) || numberOf(value) % t->count != i) reader->consistent = 0;
+            if (t->addedCount) {
+                int j = (pick >> 4) % t->addedCount;
+                SExpr* added = get(t->added[j]);
+                if (added != nil && numberOf(added) != j) reader->consistent = 0;
+            }
+        }
+        reader->lookups += 1024 + (t->addedCount ? 1024 : 0);
+    }
+    return NULL;
+}
+
+void* envWriterMain(void* context) {
+    EnvTraffic* t = (EnvTraffic*)context;
+    interp = t->interp;
+    for (int round = 1; round <= t->rounds && !LOAD_ACQUIRE(t->stop); round++) {
+        for (int i = 0; i < t->count && !LOAD_ACQUIRE(t->stop); i++) {
+            set(t->names[i], makeNumber(i + (long long)round * t->count));
+            for (int j = i; round == 1 && j < t->addedCount; j += t->count) set(t->added[j], makeNumber(j));
+            if (t->pauseNs) {
+                struct timespec pause = { 0, t->pauseNs };
+                nanosleep(&pause, NULL);
+            }
+        }
+    }
+    STORE_RELEASE(t->stop, 1);
+    return NULL;
+}
+
+// Runs readers until the writer finishes, or with a quota the writer until the
+// readers finish. Returns total lookups, or -1 if a reader saw a torn value.
+long long runEnvTraffic(EnvTraffic* t, int readers) {
+    EnvReader state[64];
+    pthread_t threads[64], writer;
+    int started = 0;
+    STORE_RELEASE(t->stop, 0);
+    atomic_fetch_add_explicit(&t->interp->sharers, 1, memory_order_relaxed);
+    for (; started < readers && started < 64; started++) {
+        state[started].traffic = t;
+        state[started].lookups = 0;
+        if (pthread_create(&threads[started], NULL, envReaderMain, &state[started]) != 0) break;
+    }
+    int writing = pthread_create(&writer, NULL, envWriterMain, t) == 0;
+    if (!writing && !t->quota) envWriterMain(t);
+    if (writing && !t->quota) pthread_join(writer, NULL);
+    long long lookups = 0;
+    int consistent = 1;
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+        lookups += state[i].lookups;
+        consistent = consistent && state[i].consistent;
+    }
+    if (writing && t->quota) {
+        STORE_RELEASE(t->stop, 1);
+        pthread_join(writer, NULL);
+    }
+    atomic_fetch_sub_explicit(&t->interp->sharers, 1, memory_order_relaxed);
+    return consistent ? lookups : -1;
+}
+#endif
+
+// Interns name<i> for i below count
+SExpr** makeNames(const char* prefix, int count) {
+    SExpr** names = malloc(count * sizeof(SExpr*));
+    if (!names) {
+        printf("Memory allocation failed for names\n");
+        exit(1);
+    }
+    char text[64];
+    for (int i = 0; i < count; i++) {
+        snprintf(text, sizeof(text), "%s%d", prefix, i);
+        names[i] = makeSymbol(text);
+    }
+    return names;
+}
+
+// Benchmark harness. A benchmark's setup builds its inputs once and returns
+// them as state; run performs one repetition of ops operations on that state.
+// Each benchmark is warmed up and then timed repetition by repetition, and the
+// report gives median and 99th percentile times (nearest rank) plus the cells
+// allocated per operation, as aligned text, JSON or CSV.
+#define BENCH_SKIP ((void*)-1)     // Returned by setup when the benchmark can't run here
+#define BENCH_WARMUP 2
+#define BENCH_SCRIPT_FORMS 20000
+
+enum { BENCH_TEXT, BENCH_JSON, BENCH_CSV };
+
+typedef struct Benchmark {
+    const char* name;
+    const char* group;          // "micro" or "macro"
+    void* (*setup)(void);       // NULL when there is nothing to prepare
+    void (*run)(void* state);
+    void (*teardown)(void* state);
+    long long ops;              // Operations per repetition
+} Benchmark;
+
+typedef struct BenchResult {
+    int reps;
+    double medianNs, p99Ns, minNs, meanNs;     // Per repetition
+    double cellsPerOp;
+} BenchResult;
+
+SExpr* volatile benchSink;     // Keeps results observable so the work isn't optimised away
+
+// Binds value to a global so the collector keeps it for the whole run
+SExpr* benchRoot(char* name, SExpr* value) {
+    set(makeSymbol(name), value);
+    return get(makeSymbol(name));
+}
+
+// Defines the procedures a macro benchmark calls and returns the form it times
+SExpr* benchProgram(char* definitions, char* form) {
+    Reader r;
+    initBufferReader(&r, definitions, strlen(definitions));
+    evalAll(&r);
+    return benchRoot("benchForm", parse(form));
+}
+
+void benchFree(void* state) {
+    free(state);
+}
+
+void runEvalTopLevel(void* form) {
+    benchSink = evalTopLevel((SExpr*)form);
+}
+
+void* setupRule(void) {
+    set(makeSymbol("score"), makeNumber(17));
+    return benchRoot("benchRule", parse("(if (and (> score 10) (<= score 100)) (add (mul score 3) (div score 2)) (sub score 1))"));
+}
+
+void runEvalDispatch(void* rule) {
+    for (int i = 0; i < 10000; i++) benchSink = eval((SExpr*)rule);
+}
+
+void* setupBytecode(void) {
+    return benchRoot("benchCode", compile(setupRule()));
+}
+
+void runBytecode(void* code) {
+    for (int i = 0; i < 10000; i++) benchSink = execute((SExpr*)code);
+}
+
+#define BENCH_GLOBALS 10000
+
+void* setupGlobals(void) {
+    SExpr** names = makeNames("benchGlobal", BENCH_GLOBALS);
+    for (int i = 0; i < BENCH_GLOBALS; i++) set(names[i], makeNumber(i));
+    return names;
+}
+
+void runGet(void* names) {
+    unsigned int pick = 1;
+    for (int i = 0; i < 100000; i++) {
+        pick = pick * 1103515245u + 12345u;
+        benchSink = get(((SExpr**)names)[(pick >> 8) % BENCH_GLOBALS]);
+    }
+}
+
+void runSet(void* names) {
+    unsigned int pick = 1;
+    for (int i = 0; i < 100000; i++) {
+        pick = pick * 1103515245u + 12345u;
+        set(((SExpr**)names)[(pick >> 8) % BENCH_GLOBALS], makeNumber(i));
+    }
+}
+
+void runConsBuild(void* state) {
+    (void)state;
+    SExpr* list = nil;
+    for (int i = 0; i < 10000; i++) list = cons(makeNumber(i), list);
+    benchSink = list;
+}
+
+void* setupArith(void) {
+    return benchProgram("(set benchSumTo (lambda (n acc) (if (< n 1) acc (benchSumTo (sub n 1) (add acc n)))))",
+        "(benchSumTo 10000 0)");
+}
+
+void* setupPrintFlat(void) {
+    SExpr* list = nil;
+    for (int i = 0; i < 10000; i++) list = cons(makeNumber(i * 104729LL - 500000), list);
+    return benchRoot("benchPrinted", list);
+}
+
+void* setupPrintNested(void) {
+    SExpr* nested = nil;
+    for (int i = 0; i < 10000; i++) nested = cons(makeNumber(i), cons(nested, nil));
+    return benchRoot("benchPrinted", nested);
+}
+
+void runPrint(void* expr) {
+    free(sprintSExpr((SExpr*)expr));
 }
 
-void initNil() {
-    if (nil == NULL) {
-        nil = (SExpr*)malloc(sizeof(SExpr));
-        nil->type = NIL;
+typedef struct BenchScript {
+    char* text;
+    size_t length;
+    char* path;         // Where the same text is written for the mapped parse
+} BenchScript;
+
+// BENCH_SCRIPT_FORMS rules in memory, also written to script->path
+void* setupScript(void) {
+    BenchScript* script = malloc(sizeof(BenchScript));
+    script->text = malloc(BENCH_SCRIPT_FORMS * 96);
+    if (!script || !script->text) {
+        printf("Memory allocation failed for benchmark script\n");
+        exit(1);
+    }
+    script->length = 0;
+    script->path = "bench_script.lisp";
+    for (int i = 0; i < BENCH_SCRIPT_FORMS; i++) {
+        script->length += sprintf(script->text + script->length,
+            "(set rule%d (if (> %d 10) (add (mul 3 4) %d) '(a b . c))) ; rule\n", i % 5000, i, i);
     }
+    FILE* file = fopen(script->path, "wb");
+    if (!file || fwrite(script->text, 1, script->length, file) != script->length) {
+        fprintf(stderr, "Error: Cannot write %s\n", script->path);
+        exit(1);
+    }
+    fclose(file);
+    return script;
 }
 
-SExpr* makeSymbol(char* name) {
-    SExpr* s = (SExpr*)malloc(sizeof(SExpr));
-    s->type = SYMBOL;
-    s->symbol = name;
-    return s;
+void teardownScript(void* state) {
+    BenchScript* script = (BenchScript*)state;
+    remove(script->path);
+    free(script->text);
+    free(script);
 }
 
-SExpr* makeNumber(int value) {
-    SExpr* n = (SExpr*)malloc(sizeof(SExpr));
-    n->type = NUMBER;
-    n->number = value;
-    return n;
+// Reads every form into the scratch arena, which is then released in one go
+void readAllScratch(Reader* r) {
+    Allocator* saved = allocator;
+    allocator = &interp->scratchAllocator;
+    while (readSExpr(r)) {}
+    freeReader(r);
+    allocator = saved;
+    arenaReset(&interp->scratchArena);
 }
 
-SExpr* cons(SExpr* car, SExpr* cdr) {
-    SExpr* c = (SExpr*)malloc(sizeof(SExpr));
-    if (!c) {
-        printf("Memory allocation failed for cons\n");
-        exit(1);  // Handle memory allocation failure gracefully
-    }
-    c->type = CONS;
-    c->car = car;
-    c->cdr = cdr;
-    return c;
+void runParseBuffer(void* state) {
+    Reader r;
+    initBufferReader(&r, ((BenchScript*)state)->text, ((BenchScript*)state)->length);
+    readAllScratch(&r);
 }
 
+void runParseMapped(void* state) {
+    char* path = ((BenchScript*)state)->path;
+    Reader r;
+    if (!initFileReader(&r, path)) {
+        fprintf(stderr, "Error: Cannot open %s\n", path);
+        exit(1);
+    }
+    readAllScratch(&r);
+}
 
-// The `makeError` function now returns an SExpr* to correctly handle errors
-SExpr* makeError(char* message) {
-    SExpr* e = (SExpr*)malloc(sizeof(SExpr));
-    e->type = SYMBOL;
-    e->symbol = message;
-    return e;
+// A rule loop that mostly reads globals, which its lambda body caches per reference
+void* setupGlobalRule(void) {
+    return benchProgram("(set ruleLimit 100) (set ruleWeight 3) (set benchRuleLoop (lambda (n acc) (if (< n 1) acc "
+        "(benchRuleLoop (sub n 1) (if (> ruleWeight ruleLimit) acc (add acc ruleWeight))))))",
+        "(benchRuleLoop 10000 0)");
 }
 
-// Arithmetic operations
-SExpr* evalAdd(SExpr* expr) {
-    return makeNumber(eval(expr->car)->number + eval(expr->cdr->car)->number);
+void* setupFib(void) {
+    return benchProgram("(set benchFib (lambda (n) (if (< n 2) n (add (benchFib (sub n 1)) (benchFib (sub n 2))))))",
+        "(benchFib 20)");
 }
 
-SExpr* evalSubtract(SExpr* expr) {
-    return makeNumber(eval(expr->car)->number - eval(expr->cdr->car)->number);
+void* setupTak(void) {
+    return benchProgram("(set benchTak (lambda (x y z) (if (< y x) "
+        "(benchTak (benchTak (sub x 1) y z) (benchTak (sub y 1) z x) (benchTak (sub z 1) x y)) z)))",
+        "(benchTak 18 12 6)");
 }
 
-SExpr* evalMultiply(SExpr* expr) {
-    return makeNumber(eval(expr->car)->number * eval(expr->cdr->car)->number);
+void* setupFactorial(void) {
+    return benchProgram("(set benchFact (lambda (n acc) (if (< n 2) acc (benchFact (sub n 1) (mul acc n)))))",
+        "(benchFact 1000 1)");
 }
 
-SExpr* evalDivide(SExpr* expr) {
-    int denominator = eval(expr->cdr->car)->number;
-    if (denominator == 0) return nil;
-    return makeNumber(eval(expr->car)->number / denominator);
+// The language has no list primitives yet, so the sort is a merge sort over
+// cells written against the cell API, allocating its output like a functional sort
+SExpr* mergeLists(SExpr* a, SExpr* b) {
+    SExpr* head = nil;
+    SExpr* tail = nil;
+    while (a != nil || b != nil) {
+        SExpr** from = b == nil || (a != nil && numberOf(a->car) <= numberOf(b->car)) ? &a : &b;
+        SExpr* cell = cons((*from)->car, nil);
+        *from = (*from)->cdr;
+        if (tail == nil) head = cell;
+        else tail->cdr = cell;
+        tail = cell;
+    }
+    return head;
 }
 
-// Logical operations
-SExpr* evalAnd(SExpr* expr) {
-    SExpr* e1 = eval(expr->car);
-    if (!isTruthy(e1)) return nil;
-    return eval(expr->cdr->car);
+// Sorted copy of the first length elements of list
+SExpr* sortList(SExpr* list, int length) {
+    if (length <= 1) return length ? cons(list->car, nil) : nil;
+    SExpr* rest = list;
+    for (int i = 0; i < length / 2; i++) rest = rest->cdr;
+    SExpr* left = sortList(list, length / 2);
+    SExpr* right = sortList(rest, length - length / 2);
+    return mergeLists(left, right);
 }
 
-SExpr* evalOr(SExpr* expr) {
-    SExpr* e1 = eval(expr->car);
-    if (isTruthy(e1)) return e1;
-    return eval(expr->cdr->car);
+void* setupSortInput(void) {
+    SExpr* list = nil;
+    unsigned int pick = 7;
+    for (int i = 0; i < 10000; i++) {
+        pick = pick * 1103515245u + 12345u;
+        list = cons(makeNumber((pick >> 8) % 100000), list);
+    }
+    return benchRoot("benchUnsorted", list);
 }
 
-// Conditional `if` expression
-SExpr* evalIf(SExpr* expr) {
-    SExpr* condition = eval(expr->car);
-    if (isTruthy(condition)) return eval(expr->cdr->car);
-    return eval(expr->cdr->cdr->car);
+void runSort(void* list) {
+    benchSink = sortList((SExpr*)list, 10000);
 }
 
-// The `cond` construct evaluation
-SExpr* evalCond(SExpr* expr) {
-    // printSExpr(exprIn->car->cdr->car);
-    // SExpr* expr = exprIn->car->cdr;
-    // printSExpr(expr->car);
-    while (expr != nil) {
-        // Check that `expr` is a cons cell
-        // printf("Entered");
-        // printf("\n");
-        if (expr->type != CONS) {
-            printf("Not CONS");
-            return makeError("COND: Malformed clause list - expected cons cell");
-        }
-        
-        SExpr* pair = expr->car;  // Extract the current clause
-        if (pair->type != CONS) {
-            printf("Pair not CONS");
-            return makeError("COND: Each clause must be a cons cell with a condition and result");
-        }
+typedef struct BenchVectors {
+    VectorKernels* kernels;
+    SExpr* a;
+    SExpr* b;
+} BenchVectors;
 
-        // Extract the condition
-        SExpr* condition = pair->car;
-        // printSExpr(pair->car->car);
-        // printf("\n");
-        // printSExpr(pair->cdr->car);
-        if (condition == nil) {
-            printf("Wrong COND");
-            return makeError("COND: Missing condition in clause");
-        }
+void* setupDot(VectorKernels* kernels) {
+    BenchVectors* state = malloc(sizeof(BenchVectors));
+    if (!state) return BENCH_SKIP;
+    state->kernels = kernels;
+    state->a = benchRoot("benchVectorA", makeVector(8192));
+    state->b = benchRoot("benchVectorB", makeVector(8192));
+    for (int i = 0; i < 8192; i++) {
+        state->a->elements[i] = i % 100;
+        state->b->elements[i] = 0.5;
+    }
+    return state;
+}
 
-        // Extract the result
-        if (pair->cdr == nil) { // || pair->cdr->type != CONS) {
-            printf("Wrong Result");
-            return makeError("COND: Missing or malformed result in clause");
-        }
-        
-        SExpr* result = pair->cdr;
-        // printSExpr(result);
-        // printSExpr(pair->car->cdr);
-        // printf("\n");
-        // Evaluate the condition
-        SExpr* eval_condition = eval(condition);
-        // printSExpr(condition->car);
-        if (eval_condition == nil) {
-            // printSExpr(eval_condition);
-            // printf("\n");
-            // printf("Fail Eval");
-            // return makeError("COND: Error evaluating condition");
-        }
+void* setupDotScalar(void) {
+    return setupDot(&scalarKernels);
+}
 
-        // Check if the condition is truthy
-        if (eval_condition != nil) { // && eval_condition->type != NIL) {
-            // Evaluate and return the result
-            SExpr* eval_result = eval(result);
-            // printSExpr(eval_result);
-            if (eval_result == nil) {
-                return makeError("COND: Error evaluating result");
-            }
-            return eval_result;
-        }
+void* setupDotSelected(void) {
+    return vectorKernels() == &scalarKernels ? BENCH_SKIP : setupDot(vectorKernels());
+}
 
-        // Move to the next condition-result pair
-        // printSExpr(expr->car->cdr);
-        // printf("\n");
-        expr = expr->car->cdr;
-        // printSExpr(expr);
-        // printf("\n");
-    }
+void runDot(void* state) {
+    BenchVectors* v = (BenchVectors*)state;
+    volatile double sum = 0;
+    for (int i = 0; i < 100; i++) sum += v->kernels->dot(v->a->elements, v->b->elements, 8192);
+}
 
-    return nil;  // If no condition is truthy, return nil
+// Writes a script for the batch runner; the sink is where its output goes
+FILE* setupBatchScript(char* definitions, char* format, int forms, int spread) {
+    FILE* script = fopen("bench_batch.lisp", "wb");
+    FILE* sink = fopen("bench_batch.out", "wb");
+    if (!script || !sink) {
+        if (script) fclose(script);
+        if (sink) fclose(sink);
+        return BENCH_SKIP;
+    }
+    fputs(definitions, script);
+    for (int i = 0; i < forms; i++) fprintf(script, format, spread ? 14 + i % spread : i, i, i, i);
+    fclose(script);
+    return sink;
 }
 
-// Comparison operations
-SExpr* evalGreaterThan(SExpr* expr) {
-    return eval(expr->car)->number > eval(expr->cdr->car)->number ? makeSymbol("t") : nil;
+void* setupBatch(void) {
+    return setupBatchScript("(set benchSquare (lambda (x) (mul x x)))\n",
+        "(if (> (benchSquare %d) 1000) (add (mul %d 3) 7) '(a b %d)) ; line %d\n", BENCH_SCRIPT_FORMS, 0);
 }
 
-SExpr* evalLessThan(SExpr* expr) {
-    return eval(expr->car)->number < eval(expr->cdr->car)->number ? makeSymbol("t") : nil;
+void* setupParallel(void) {
+    return setupBatchScript("(set benchFibP (lambda (n) (if (< n 2) n (add (benchFibP (sub n 1)) (benchFibP (sub n 2))))))\n",
+        "(benchFibP %d)\n", 400, 6);
 }
 
-SExpr* evalGreaterEqual(SExpr* expr) {
-    return eval(expr->car)->number >= eval(expr->cdr->car)->number ? makeSymbol("t") : nil;
+void teardownBatch(void* sink) {
+    fclose((FILE*)sink);
+    remove("bench_batch.out");
+    remove("bench_batch.lisp");
 }
 
-SExpr* evalLessEqual(SExpr* expr) {
-    return eval(expr->car)->number <= eval(expr->cdr->car)->number ? makeSymbol("t") : nil;
+void runBatchSequential(void* sink) {
+    runBatch("bench_batch.lisp", (FILE*)sink, 0, 1);
 }
 
-void set(SExpr* name, SExpr* value) {
-    // Ensure name is a symbol
-    if (name->type != SYMBOL) {
-        fprintf(stderr, "Error: Name must be a symbol\n");
-        return;
-    }
+void runBatchPipelined(void* sink) {
+    runBatch("bench_batch.lisp", (FILE*)sink, 1, 1);
+}
 
-    // Check if the symbol already exists in the environment
-    Env* current = global_env;
-    while (current) {
-        if (strcmp(current->name->symbol, name->symbol) == 0) {
-            current->value = value; // Update value
-            return;
-        }
-        current = current->next;
-    }
+void runParallel1(void* sink) {
+    runBatch("bench_batch.lisp", (FILE*)sink, 1, 1);
+}
 
-    // Add a new entry to the environment
-    Env* new_entry = malloc(sizeof(Env));
-    if (!new_entry) {
-        fprintf(stderr, "Error: Memory allocation failed for environment entry\n");
-        return;
-    }
-    new_entry->name = name;
-    new_entry->value = value;
-    new_entry->next = global_env;
-    global_env = new_entry;
+void runParallel4(void* sink) {
+    runBatch("bench_batch.lisp", (FILE*)sink, 1, 4);
 }
 
-SExpr* get(SExpr* name) {
-    // Ensure name is a symbol
-    if (name->type != SYMBOL) {
-        fprintf(stderr, "Error: Name must be a symbol\n");
-        return nil;
-    }
+#define BENCH_ENV_QUOTA 200000
 
-    // Search for the symbol in the environment
-    Env* current = global_env;
-    while (current) {
-        if (strcmp(current->name->symbol, name->symbol) == 0) {
-            return current->value;
-        }
-        current = current->next;
-    }
+// Readers with a fixed quota of lookups each, while a writer updates a binding every 50 us.
+// The sweep doubles the readers up to the number of online cores.
+void* setupEnvTraffic(int readers) {
+#ifdef LISP_THREADS
+    if (readers > 1 && readers > sysconf(_SC_NPROCESSORS_ONLN)) return BENCH_SKIP;
+    EnvTraffic* traffic = calloc(1, sizeof(EnvTraffic));
+    if (!traffic) return BENCH_SKIP;
+    traffic->interp = interp;
+    traffic->readers = readers;
+    traffic->names = makeNames("benchConfig", 10000);
+    traffic->count = 10000;
+    traffic->rounds = INT_MAX;
+    traffic->pauseNs = 50000;
+    traffic->quota = BENCH_ENV_QUOTA;
+    for (int i = 0; i < traffic->count; i++) set(traffic->names[i], makeNumber(i));
+    return traffic;
+#else
+    (void)readers;
+    return BENCH_SKIP;
+#endif
+}
+
+void* setupEnvRead1(void) { return setupEnvTraffic(1); }
+void* setupEnvRead2(void) { return setupEnvTraffic(2); }
+void* setupEnvRead4(void) { return setupEnvTraffic(4); }
+void* setupEnvRead8(void) { return setupEnvTraffic(8); }
+void* setupEnvRead16(void) { return setupEnvTraffic(16); }
+void* setupEnvRead32(void) { return setupEnvTraffic(32); }
+void* setupEnvRead64(void) { return setupEnvTraffic(64); }
 
-    return nil; // Symbol not found
+void teardownEnvTraffic(void* state) {
+#ifdef LISP_THREADS
+    free(((EnvTraffic*)state)->names);
+    free(state);
+#endif
 }
 
-SExpr* eq(SExpr* a, SExpr* b) {
-    // printf(a->number);
-    // printf(" ");
-    // printf(b->number);
-    // printf("\n");
-    // Compare numbers
-    if (a->type == NUMBER && b->type == NUMBER) {
-        // printf("Is Number");
-        // printf("\n");
-        return a->number == b->number ? makeSymbol("t") : nil;
-    }
+void runEnvRead(void* state) {
+#ifdef LISP_THREADS
+    EnvTraffic* traffic = (EnvTraffic*)state;
+    if (runEnvTraffic(traffic, traffic->readers) < 0) printf("env.read: inconsistent read\n");
+#else
+    (void)state;
+#endif
+}
 
-    // Compare symbols
-    if (a->type == SYMBOL && b->type == SYMBOL) {
-        // printf("Is Symbol");
-        // printf("\n");
-        return strcmp(a->symbol, b->symbol) == 0 ? makeSymbol("t") : nil;
-    }
+Benchmark benchmarks[] = {
+    { "eval.dispatch", "micro", setupRule, runEvalDispatch, NULL, 10000 },
+    { "eval.bytecode", "micro", setupBytecode, runBytecode, NULL, 10000 },
+    { "globals.get", "micro", setupGlobals, runGet, benchFree, 100000 },
+    { "globals.set", "micro", setupGlobals, runSet, benchFree, 100000 },
+    { "cons.build", "micro", NULL, runConsBuild, NULL, 10000 },
+    { "arith.loop", "micro", setupArith, runEvalTopLevel, NULL, 10000 },
+    { "globals.rule", "micro", setupGlobalRule, runEvalTopLevel, NULL, 10000 },
+    { "print.flat", "micro", setupPrintFlat, runPrint, NULL, 10000 },
+    { "print.nested", "micro", setupPrintNested, runPrint, NULL, 10000 },
+    { "parse.buffer", "micro", setupScript, runParseBuffer, teardownScript, BENCH_SCRIPT_FORMS },
+    { "parse.mapped", "micro", setupScript, runParseMapped, teardownScript, BENCH_SCRIPT_FORMS },
+    { "vector.dot.scalar", "micro", setupDotScalar, runDot, benchFree, 8192 * 100 },
+    { "vector.dot.simd", "micro", setupDotSelected, runDot, benchFree, 8192 * 100 },
+    { "env.read.1thread", "micro", setupEnvRead1, runEnvRead, teardownEnvTraffic, BENCH_ENV_QUOTA },
+    { "env.read.2threads", "micro", setupEnvRead2, runEnvRead, teardownEnvTraffic, 2 * BENCH_ENV_QUOTA },
+    { "env.read.4threads", "micro", setupEnvRead4, runEnvRead, teardownEnvTraffic, 4 * BENCH_ENV_QUOTA },
+    { "env.read.8threads", "micro", setupEnvRead8, runEnvRead, teardownEnvTraffic, 8 * BENCH_ENV_QUOTA },
+    { "env.read.16threads", "micro", setupEnvRead16, runEnvRead, teardownEnvTraffic, 16 * BENCH_ENV_QUOTA },
+    { "env.read.32threads", "micro", setupEnvRead32, runEnvRead, teardownEnvTraffic, 32 * BENCH_ENV_QUOTA },
+    { "env.read.64threads", "micro", setupEnvRead64, runEnvRead, teardownEnvTraffic, 64 * BENCH_ENV_QUOTA },
+    { "fib", "macro", setupFib, runEvalTopLevel, NULL, 1 },
+    { "tak", "macro", setupTak, runEvalTopLevel, NULL, 1 },
+    { "list.sort", "macro", setupSortInput, runSort, NULL, 1 },
+    { "bignum.factorial", "macro", setupFactorial, runEvalTopLevel, NULL, 1 },
+    { "batch.sequential", "macro", setupBatch, runBatchSequential, teardownBatch, BENCH_SCRIPT_FORMS },
+    { "batch.pipelined", "macro", setupBatch, runBatchPipelined, teardownBatch, BENCH_SCRIPT_FORMS },
+    { "parallel.1job", "macro", setupParallel, runParallel1, teardownBatch, 400 },
+    { "parallel.4jobs", "macro", setupParallel, runParallel4, teardownBatch, 400 },
+};
 
-    // Types mismatch
-    return nil;
+int compareDoubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
 }
 
-// Evaluation function for all expressions
-SExpr* eval(SExpr* expr) {
-    if (expr == nil) return nil;
-    if (expr->type == NUMBER || expr->type == NIL) return expr;
-    if (expr->type == SYMBOL) {
-        if (strcmp(expr->symbol, "t") == 0) return makeSymbol("t");
-        return nil;
+BenchResult measure(const Benchmark* bench, void* state, int reps) {
+    for (int i = 0; i < BENCH_WARMUP; i++) bench->run(state);
+    double* samples = malloc(reps * sizeof(double));
+    if (!samples) {
+        printf("Memory allocation failed for benchmark samples\n");
+        exit(1);
     }
-    SExpr* function = expr->car;  // First element
-    SExpr* args = expr->cdr;  
-    if (strcmp(function->symbol, "quote") == 0) {
-        if (args == nil || args->type != CONS) {
-            return makeError("QUOTE: Missing or malformed argument");
-        }
-        return args->car; // Return cadr (car of cdr)
+    size_t cellsBefore = cellsAllocated();
+    for (int i = 0; i < reps; i++) {
+        long long start = nowNanos();
+        bench->run(state);
+        samples[i] = (double)(nowNanos() - start);
     }
-    if (strcmp(function->symbol, "set") == 0) {
-        if (args == nil || args->type != CONS || args->cdr == nil || args->cdr->cdr == nil) {
-            return makeError("SET: Missing or malformed arguments");
-        }
-        SExpr* name = args->car;         // First argument
-        SExpr* valueExpr = args->cdr->car; // Second argument (value)
-        
-        if (name->type != SYMBOL) {
-            return makeError("SET: First argument must be a symbol");
-        }
-        
-        SExpr* value = eval(valueExpr); // Evaluate value
-        if (value == nil) {
-            return makeError("SET: Error evaluating value");
-        }
+    BenchResult result;
+    result.reps = reps;
+    result.cellsPerOp = (double)(cellsAllocated() - cellsBefore) / ((double)reps * bench->ops);
+    qsort(samples, reps, sizeof(double), compareDoubles);
+    result.minNs = samples[0];
+    result.medianNs = reps % 2 ? samples[reps / 2] : (samples[reps / 2 - 1] + samples[reps / 2]) / 2;
+    int rank = (int)(0.99 * reps + 0.999999);     // Nearest rank, 1-based
+    result.p99Ns = samples[(rank < 1 ? 1 : rank) - 1];
+    result.meanNs = 0;
+    for (int i = 0; i < reps; i++) result.meanNs += samples[i] / reps;
+    free(samples);
+    return result;
+}
 
-        set(name, value); // Store in environment
-        return value;     // Return the evaluated value
-    }
-    if (strcmp(function->symbol, "eq") == 0) {
-        // printSExpr(args->car);
-        // printf("\n");
-        // printSExpr(args->cdr->car);
-        // printf("\n");
-        SExpr* arg1 = eval(args->car);
-        SExpr* arg2 = eval(args->cdr->car);
-        return eq(arg1, arg2);
-    }
-    if (strcmp(function->symbol, "lambda") == 0) {
-        SExpr* params = args->car;
-        SExpr* body = args->cdr->car;
-
-        // Create the lambda
-        SExpr* lambda = malloc(sizeof(SExpr));
-        lambda->type = LAMBDA;
-        lambda->params = params;
-        lambda->body = body;
-        // lambda->env = current_env; // Save the closure's environment
-        return lambda;
-    }
-    if (expr->type == CONS) {
-        SExpr* first = expr->car;
-        if (first->type == SYMBOL) {
-            if (strcmp(first->symbol, "add") == 0) return evalAdd(expr->cdr);
-            if (strcmp(first->symbol, "sub") == 0) return evalSubtract(expr->cdr);
-            if (strcmp(first->symbol, "mul") == 0) return evalMultiply(expr->cdr);
-            if (strcmp(first->symbol, "div") == 0) return evalDivide(expr->cdr);
-            if (strcmp(first->symbol, "and") == 0) return evalAnd(expr->cdr);
-            if (strcmp(first->symbol, "or") == 0) return evalOr(expr->cdr);
-            if (strcmp(first->symbol, "if") == 0) return evalIf(expr->cdr);
-            if (strcmp(first->symbol, "cond") == 0) return evalCond(expr->cdr);
-            if (strcmp(first->symbol, ">") == 0) return evalGreaterThan(expr->cdr);
-            if (strcmp(first->symbol, "<") == 0) return evalLessThan(expr->cdr);
-            if (strcmp(first->symbol, ">=") == 0) return evalGreaterEqual(expr->cdr);
-            if (strcmp(first->symbol, "<=") == 0) return evalLessEqual(expr->cdr);
-        }
+void reportResult(FILE* out, int format, const Benchmark* bench, BenchResult* r, int first) {
+    double ops = (double)bench->ops;
+    if (format == BENCH_JSON) {
+        fprintf(out, "%s\n    { \"name\": \"%s\", \"group\": \"%s\", \"ops_per_rep\": %lld, \"reps\": %d, "
+            "\"median_ns\": %.0f, \"p99_ns\": %.0f, \"min_ns\": %.0f, \"mean_ns\": %.0f, "
+            "\"median_ns_per_op\": %.3f, \"p99_ns_per_op\": %.3f, \"cells_per_op\": %.3f }",
+            first ? "" : ",", bench->name, bench->group, bench->ops, r->reps, r->medianNs, r->p99Ns, r->minNs, r->meanNs,
+            r->medianNs / ops, r->p99Ns / ops, r->cellsPerOp);
+    } else if (format == BENCH_CSV) {
+        fprintf(out, "%s,%s,%lld,%d,%.0f,%.0f,%.0f,%.0f,%.3f,%.3f,%.3f\n", bench->name, bench->group, bench->ops, r->reps,
+            r->medianNs, r->p99Ns, r->minNs, r->meanNs, r->medianNs / ops, r->p99Ns / ops, r->cellsPerOp);
+    } else {
+        fprintf(out, "%-20s %-6s %12.1f %12.1f %14.0f %10.2f\n", bench->name, bench->group,
+            r->medianNs / ops, r->p99Ns / ops, ops * 1e9 / r->medianNs, r->cellsPerOp);
     }
-    return nil;
+    fflush(out);
 }
 
-void printSExpr(SExpr* expr) {
-    if (expr == nil || expr == NULL) {
-        printf("nil");
-        return;
+// Runs every benchmark whose name contains filter (all of them when it is NULL)
+void runBenchmarks(FILE* out, int format, int reps, const char* filter) {
+    if (reps < 1) reps = 1;
+    if (format == BENCH_JSON) {
+        fprintf(out, "{\n  \"kernels\": \"%s\",\n  \"warmup\": %d,\n  \"benchmarks\": [", vectorKernels()->name, BENCH_WARMUP);
+    } else if (format == BENCH_CSV) {
+        fprintf(out, "name,group,ops_per_rep,reps,median_ns,p99_ns,min_ns,mean_ns,median_ns_per_op,p99_ns_per_op,cells_per_op\n");
+    } else {
+        fprintf(out, "%-20s %-6s %12s %12s %14s %10s\n", "benchmark", "group", "median ns/op", "p99 ns/op", "ops/s", "cells/op");
     }
-
-    switch (expr->type) {
-        case SYMBOL:
-            printf("%s", expr->symbol);
-            break;
-
-        case NUMBER:
-            printf("%d", expr->number);
-            break;
-
-        case CONS: {
-            printf("(");
-            SExpr* current = expr;
-            while (current != nil && current->type == CONS) {
-                printSExpr(current->car);
-                current = current->cdr;
-                if (current != nil && current->type == CONS) {
-                    printf(" ");
-                }
-            }
-            if (current != nil && current != nil) {
-                printf(" . ");
-                printSExpr(current);  // Print the improper list tail
-            }
-            printf(")");
-            break;
-        }
-
-        case NIL:
-            printf("nil");
-            break;
-
-        default:
-            printf("Unknown");
-            break;
+    int first = 1;
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+        const Benchmark* bench = &benchmarks[i];
+        if (filter && !strstr(bench->name, filter)) continue;
+        void* state = bench->setup ? bench->setup() : NULL;
+        if (state == BENCH_SKIP) continue;
+        BenchResult result = measure(bench, state, reps);
+        if (bench->teardown) bench->teardown(state);
+        reportResult(out, format, bench, &result, first);
+        first = 0;
     }
+    if (format == BENCH_JSON) fprintf(out, "\n  ]\n}\n");
+    fflush(out);
+}
+
+// One request-handling thread: its own instance, a small heap so the collector runs often
+void* embedSession(void* context) {
+    Interp* in = lispCreate(__builtin_frame_address(0));
+    in->heap.threshold = in->heap.minThreshold = 16 * 1024;
+    lispEval(in, "(set fib (lambda (n) (if (< n 2) n (add (fib (sub n 1)) (fib (sub n 2)))))) (set n 0)");
+    for (int i = 0; i < 2000; i++) lispEval(in, "(set n (add n 1)) (set kept (mul 99999999999 n 99999999999))");
+    char* kept = sprintSExpr(lispGet(in, "kept"));
+    *(int*)context = numberOf(lispGet(in, "n")) == 2000 && numberOf(lispEval(in, "(fib 15)")) == 610 &&
+        strcmp(kept, "19999999999600000000002000") == 0 && in->heap.stats.collections > 0;
+    free(kept);
+    lispDestroy(in);
+    return NULL;
 }
 
 void runTests() {
@@ -409,13 +5007,13 @@ void runTests() {
 
     // Arithmetic Tests
     fprintf(outFile, "Test 1 (Add 2 + 3): %s\n", 
-        eval(cons(makeSymbol("add"), cons(makeNumber(2), cons(makeNumber(3), nil))))->number == 5 ? "pass" : "fail");
+        numberOf(eval(cons(makeSymbol("add"), cons(makeNumber(2), cons(makeNumber(3), nil))))) == 5 ? "pass" : "fail");
     fprintf(outFile, "Test 2 (Subtract 5 - 3): %s\n", 
-        eval(cons(makeSymbol("sub"), cons(makeNumber(5), cons(makeNumber(3), nil))))->number == 2 ? "pass" : "fail");
+        numberOf(eval(cons(makeSymbol("sub"), cons(makeNumber(5), cons(makeNumber(3), nil))))) == 2 ? "pass" : "fail");
     fprintf(outFile, "Test 3 (Multiply 4 * 3): %s\n", 
-        eval(cons(makeSymbol("mul"), cons(makeNumber(4), cons(makeNumber(3), nil))))->number == 12 ? "pass" : "fail");
+        numberOf(eval(cons(makeSymbol("mul"), cons(makeNumber(4), cons(makeNumber(3), nil))))) == 12 ? "pass" : "fail");
     fprintf(outFile, "Test 4 (Divide 10 / 2): %s\n", 
-        eval(cons(makeSymbol("div"), cons(makeNumber(10), cons(makeNumber(2), nil))))->number == 5 ? "pass" : "fail");
+        numberOf(eval(cons(makeSymbol("div"), cons(makeNumber(10), cons(makeNumber(2), nil))))) == 5 ? "pass" : "fail");
     fprintf(outFile, "Test 5 (Divide by zero): %s\n", 
         eval(cons(makeSymbol("div"), cons(makeNumber(10), cons(makeNumber(0), nil)))) == nil ? "pass" : "fail");
 
@@ -439,7 +5037,7 @@ void runTests() {
 
     // Equality Tests
     fprintf(outFile, "Test 13 (eq two equal numbers): %s\n", 
-        eval(cons(makeSymbol("eq"), cons(makeNumber(42), cons(makeNumber(42), nil)))) == makeSymbol("t") ? "fail" : "pass");
+        eval(cons(makeSymbol("eq"), cons(makeNumber(42), cons(makeNumber(42), nil)))) == makeSymbol("t") ? "pass" : "fail");
     fprintf(outFile, "Test 14 (eq two different numbers): %s\n", 
         eval(cons(makeSymbol("eq"), cons(makeNumber(42), cons(makeNumber(100), nil)))) == nil ? "pass" : "fail");
     fprintf(outFile, "Test 15 (eq two equal symbols): %s\n", 
@@ -451,53 +5049,733 @@ void runTests() {
 
     // Conditional Tests
     fprintf(outFile, "Test 18 (if true): %s\n", 
-        eval(cons(makeSymbol("if"), cons(makeSymbol("t"), cons(makeNumber(10), cons(makeNumber(20), nil)))))->number == 10 ? "pass" : "fail");
+        numberOf(eval(cons(makeSymbol("if"), cons(makeSymbol("t"), cons(makeNumber(10), cons(makeNumber(20), nil)))))) == 10 ? "pass" : "fail");
     fprintf(outFile, "Test 19 (if false - nil): %s\n", 
-        eval(cons(makeSymbol("if"), cons(nil, cons(makeNumber(10), cons(makeNumber(20), nil)))))->number == 20 ? "pass" : "fail");
+        numberOf(eval(cons(makeSymbol("if"), cons(nil, cons(makeNumber(10), cons(makeNumber(20), nil)))))) == 20 ? "pass" : "fail");
     fprintf(outFile, "Test 20 (if false - 0): %s\n", 
-        eval(cons(makeSymbol("if"), cons(makeNumber(0), cons(makeNumber(10), cons(makeNumber(20), nil)))))->number == 20 ? "pass" : "fail");
+        numberOf(eval(cons(makeSymbol("if"), cons(makeNumber(0), cons(makeNumber(10), cons(makeNumber(20), nil)))))) == 20 ? "pass" : "fail");
 
     // Nested Conditional Tests
     fprintf(outFile, "Test 21 (if (and t t) 42 0): %s\n", 
-        eval(cons(makeSymbol("if"), 
+        numberOf(eval(cons(makeSymbol("if"), 
             cons(cons(makeSymbol("and"), cons(makeSymbol("t"), cons(makeSymbol("t"), nil))), 
-                cons(makeNumber(42), cons(makeNumber(0), nil)))))->number == 42 ? "pass" : "fail");
+                cons(makeNumber(42), cons(makeNumber(0), nil)))))) == 42 ? "pass" : "fail");
     fprintf(outFile, "Test 22 (cond ((nil 5) (t 10) (t 15))): %s\n", 
-        eval(cons(makeSymbol("cond"), 
+        numberOf(eval(cons(makeSymbol("cond"), 
             cons(cons(cons(makeSymbol("nil"), makeNumber(5)), 
                 cons(cons(makeSymbol("t"), makeNumber(10)), 
                     cons(cons(makeSymbol("t"), makeNumber(15)), nil))), 
-                nil)))->number == 10 ? "pass" : "fail");
+                nil)))) == 10 ? "pass" : "fail");
     fprintf(outFile, "Test 23 (cond ((t 5) (t 10) (nil 15))): %s\n", 
-        eval(cons(makeSymbol("cond"), 
+        numberOf(eval(cons(makeSymbol("cond"), 
             cons(cons(cons(makeSymbol("t"), makeNumber(5)), 
                 cons(cons(makeSymbol("t"), makeNumber(10)), 
                     cons(cons(makeSymbol("nil"), makeNumber(15)), nil))), 
-                nil)))->number == 10 ? "pass" : "fail");
+                nil)))) == 10 ? "pass" : "fail");
 
     // Set and Quote Tests
     eval(cons(makeSymbol("set"), cons(makeSymbol("x"), cons(makeNumber(42), nil))));
     fprintf(outFile, "Test 24 (set and get a symbol): %s\n",
-        get(makeSymbol("x"))->number == 42 ? "fail" : "pass");
+        numberOf(get(makeSymbol("x"))) == 42 ? "pass" : "fail");
 
     eval(cons(makeSymbol("set"), cons(makeSymbol("y"), cons(makeSymbol("x"), nil))));
     fprintf(outFile, "Test 25 (set a symbol to another symbol's value): %s\n",
-        get(makeSymbol("y"))->number == 42 ? "fail" : "pass");
+        numberOf(get(makeSymbol("y"))) == 42 ? "pass" : "fail");
 
     eval(cons(makeSymbol("set"), cons(makeSymbol("x"), cons(makeNumber(99), nil))));
     fprintf(outFile, "Test 26 (update a symbol's value): %s\n",
-        get(makeSymbol("x"))->number == 99 ? "fail" : "pass");
+        numberOf(get(makeSymbol("x"))) == 99 ? "pass" : "fail");
 
     fprintf(outFile, "Test 27 (quote a symbol): %s\n",
         eval(cons(makeSymbol("quote"), cons(makeSymbol("x"), nil)))->symbol == makeSymbol("x")->symbol ? "pass" : "fail");
     fprintf(outFile, "Test 28 (quote a number): %s\n",
-        eval(cons(makeSymbol("quote"), cons(makeNumber(42), nil)))->number == 42 ? "pass" : "fail");
+        numberOf(eval(cons(makeSymbol("quote"), cons(makeNumber(42), nil)))) == 42 ? "pass" : "fail");
     fprintf(outFile, "Test 29 (quote a list): %s\n",
-        eval(cons(makeSymbol("quote"), cons(cons(makeSymbol("x"), cons(makeNumber(42), nil)), nil)))->type == CONS ? "pass" : "fail");
+        typeOf(eval(cons(makeSymbol("quote"), cons(cons(makeSymbol("x"), cons(makeNumber(42), nil)), nil)))) == CONS ? "pass" : "fail");
 
     // Lambda Test
     fprintf(outFile, "Test 30 (simple lambda creation): %s\n", 
-        eval(cons(makeSymbol("lambda"), cons(cons(makeSymbol("x"), nil), cons(makeNumber(5), nil))))->type == LAMBDA ? "pass" : "fail");
+        typeOf(eval(cons(makeSymbol("lambda"), cons(cons(makeSymbol("x"), nil), cons(makeNumber(5), nil))))) == LAMBDA ? "pass" : "fail");
+
+    // Symbol Interning Tests
+    fprintf(outFile, "Test 31 (symbols are interned): %s\n",
+        makeSymbol("foo") == makeSymbol("foo") && makeSymbol("foo") != makeSymbol("bar") ? "pass" : "fail");
+    fprintf(outFile, "Test 32 (eq two quoted symbols): %s\n",
+        eval(cons(makeSymbol("eq"), cons(cons(makeSymbol("quote"), cons(makeSymbol("foo"), nil)),
+            cons(cons(makeSymbol("quote"), cons(makeSymbol("foo"), nil)), nil)))) == makeSymbol("t") ? "pass" : "fail");
+
+    // Global Environment Tests
+    char name[32];
+    for (int i = 0; i < 2000; i++) {
+        sprintf(name, "g%d", i);
+        set(makeSymbol(name), makeNumber(i));
+    }
+    int allFound = 1;
+    for (int i = 0; i < 2000; i++) {
+        sprintf(name, "g%d", i);
+        if (numberOf(get(makeSymbol(name))) != i) allFound = 0;
+    }
+    fprintf(outFile, "Test 33 (set and get 2000 globals): %s\n", allFound ? "pass" : "fail");
+    fprintf(outFile, "Test 34 (evaluate a global symbol): %s\n",
+        numberOf(eval(cons(makeSymbol("add"), cons(makeSymbol("g1000"), cons(makeNumber(1), nil))))) == 1001 ? "pass" : "fail");
+
+    // Arena Tests
+    SExpr* sum = evalTopLevel(cons(makeSymbol("add"), cons(makeNumber(2), cons(makeNumber(3), nil))));
+    fprintf(outFile, "Test 35 (top-level form resets scratch arena): %s\n",
+        numberOf(sum) == 5 && interp->scratchArena.allocated == 0 && !arenaContains(&interp->scratchArena, sum) ? "pass" : "fail");
+    evalTopLevel(cons(makeSymbol("set"), cons(makeSymbol("z"),
+        cons(cons(makeSymbol("mul"), cons(makeNumber(6), cons(makeNumber(7), nil))), nil))));
+    fprintf(outFile, "Test 36 (set value survives scratch reset): %s\n",
+        numberOf(get(makeSymbol("z"))) == 42 && !arenaContains(&interp->scratchArena, get(makeSymbol("z"))) ? "pass" : "fail");
+
+    // Garbage Collector Tests
+    size_t collectionsBefore = interp->heap.stats.collections;
+    size_t reclaimedBefore = interp->heap.stats.bytesReclaimed;
+    for (int i = 0; i < 100000; i++) {
+        eval(cons(makeSymbol("add"), cons(makeNumber(i), cons(makeNumber(1), nil))));
+    }
+    fprintf(outFile, "Test 37 (collector reclaims garbage): %s\n",
+        interp->heap.stats.collections > collectionsBefore && interp->heap.stats.bytesReclaimed > reclaimedBefore ? "pass" : "fail");
+    SExpr* kept = cons(makeNumber(7), cons(makeNumber(8), nil));
+    gcCollect();
+    fprintf(outFile, "Test 38 (collector keeps globals and stack values): %s\n",
+        numberOf(get(makeSymbol("g1999"))) == 1999 && numberOf(get(makeSymbol("z"))) == 42 &&
+        typeOf(kept) == CONS && numberOf(kept->car) == 7 && numberOf(kept->cdr->car) == 8 ? "pass" : "fail");
+
+    // Immediate Fixnum Tests
+    SExpr* arithmetic = cons(makeSymbol("add"), cons(cons(makeSymbol("mul"), cons(makeNumber(6), cons(makeNumber(7), nil))),
+        cons(cons(makeSymbol("div"), cons(makeNumber(9), cons(makeNumber(3), nil))), nil)));
+    SExpr* comparison = cons(makeSymbol("<="), cons(makeNumber(3), cons(makeNumber(4), nil)));
+    size_t allocatedBefore = interp->heap.stats.bytesAllocated;
+    int arithmeticOk = 1;
+    for (int i = 0; i < 1000; i++) {
+        if (numberOf(eval(arithmetic)) != 45 || eval(comparison) != truth) arithmeticOk = 0;
+    }
+    fprintf(outFile, "Test 39 (arithmetic and comparisons allocate nothing): %s\n",
+        arithmeticOk && interp->heap.stats.bytesAllocated == allocatedBefore ? "pass" : "fail");
+    fprintf(outFile, "Test 40 (fixnums and singletons): %s\n",
+        isFixnum(makeNumber(-123)) && numberOf(makeNumber(-123)) == -123 && makeSymbol("t") == truth &&
+        eval(cons(makeSymbol("eq"), cons(makeNumber(1), cons(makeNumber(1), nil)))) == truth ? "pass" : "fail");
+
+    // Reader Tests
+    fprintf(outFile, "Test 41 (read and evaluate nested list): %s\n",
+        numberOf(eval(parse("(add 1 ; comment\n  (mul 2 -3))"))) == -5 ? "pass" : "fail");
+    SExpr* pair = eval(parse("'(a . b)"));
+    fprintf(outFile, "Test 42 (read quote and dotted pair): %s\n",
+        typeOf(pair) == CONS && pair->car == makeSymbol("a") && pair->cdr == makeSymbol("b") &&
+        parse("nil") == nil && parse("t") == truth ? "pass" : "fail");
+    FILE* script = tmpfile();
+    int streamOk = 0;
+    if (script) {
+        for (int i = 0; i < 20000; i++) fprintf(script, "(add %d 1)\n", i);
+        for (int i = 0; i < 100000; i++) fputc('s', script);
+        rewind(script);
+        Reader reader;
+        initStreamReader(&reader, script);
+        SExpr* form;
+        int forms = 0;
+        streamOk = 1;
+        while ((form = readSExpr(&reader)) != NULL) {
+            if (forms < 20000 && numberOf(eval(form)) != forms + 1) streamOk = 0;
+            if (forms == 20000 && strlen(form->symbol) != 100000) streamOk = 0;
+            forms++;
+        }
+        streamOk = streamOk && forms == 20001 && reader.error == NULL;
+        freeReader(&reader);
+        fclose(script);
+    }
+    fprintf(outFile, "Test 43 (stream reader across chunk boundaries): %s\n", streamOk ? "pass" : "fail");
+    Reader bad;
+    initBufferReader(&bad, "(add 1 2))", 10);
+    int badOk = readSExpr(&bad) != NULL && readSExpr(&bad) == NULL && bad.error != NULL;
+    freeReader(&bad);
+    fprintf(outFile, "Test 44 (reader reports unbalanced input): %s\n",
+        badOk && parse("(add 1") != nil ? "pass" : "fail");
+
+    // Mapped File Tests
+    char scriptPath[] = "mapped_test.lisp";
+    FILE* mappedScript = fopen(scriptPath, "w");
+    int mappedOk = 0;
+    if (mappedScript) {
+        fprintf(mappedScript, "(set mappedRule (add 40 2))\n(set mappedList '(mappedRule alpha))\n(if mappedRule mappedRule 0)");
+        fclose(mappedScript);
+        SExpr* last = loadFile(scriptPath);
+        SExpr* list = get(makeSymbol("mappedList"));
+        mappedOk = numberOf(last) == 42 && typeOf(list) == CONS && list->car == makeSymbol("mappedRule") &&
+            list->cdr->car == makeSymbol("alpha") && strcmp(list->cdr->car->symbol, "alpha") == 0;
+        remove(scriptPath);
+    }
+    fprintf(outFile, "Test 45 (load a memory-mapped script): %s\n", mappedOk ? "pass" : "fail");
+
+    // Bytecode Tests
+    char* programs[] = {
+        "(add (mul 6 7) (div 9 3))", "(sub 2 10)", "(div 5 0)", "(if (> 3 2) 'yes 'no)", "(if (<= 3 2) 1 (add 1 1))",
+        "(and t (>= 4 4))", "(and nil t)", "(or nil 7)", "(or 0 nil)", "(eq 'a 'a)", "(eq 1 2)",
+        "(cond (((t . 1)) (t . 2)))", "(add mappedRule 1)", "(quote (1 2 3))", "7", "nil",
+    };
+    int vmOk = 1;
+    for (size_t i = 0; i < sizeof(programs) / sizeof(programs[0]); i++) {
+        SExpr* program = parse(programs[i]);
+        SExpr* expected = eval(program);
+        SExpr* actual = execute(compile(program));
+        if (typeOf(expected) != typeOf(actual) ||
+            (typeOf(expected) == NUMBER ? numberOf(expected) != numberOf(actual) :
+             typeOf(expected) != CONS && expected != actual)) vmOk = 0;
+    }
+    fprintf(outFile, "Test 46 (bytecode matches tree-walking eval): %s\n", vmOk ? "pass" : "fail");
+    set(makeSymbol("counter"), makeNumber(0));
+    SExpr* rule = compile(parse("(set counter (if (> counter -1) (add counter 1) 0))"));
+    for (int i = 0; i < 50000; i++) {
+        cons(makeNumber(i), nil);   // Garbage to force collections while the code object is live
+        eval(rule);
+    }
+    gcCollect();
+    SExpr* quoted = execute(compile(parse("'(keep me)")));
+    fprintf(outFile, "Test 47 (compiled code survives collection): %s\n",
+        numberOf(get(makeSymbol("counter"))) == 50000 && numberOf(execute(rule)) == 50001 &&
+        typeOf(quoted) == CONS && quoted->car == makeSymbol("keep") ? "pass" : "fail");
+
+    fprintf(outFile, "Test 48 (apply a lambda): %s\n",
+        numberOf(evalTopLevel(parse("((lambda (x y) (add x y)) 3 4)"))) == 7 &&
+        numberOf(evalTopLevel(parse("((lambda (a b c d) (sub (mul a b) (add c d))) 5 6 7 8)"))) == 15 &&
+        evalTopLevel(parse("((lambda (add) (add add add)) 4)")) == nil &&
+        typeOf(evalTopLevel(parse("((lambda (x) x) 1 2)"))) == SYMBOL ? "pass" : "fail");
+
+    evalTopLevel(parse("(set makeAdder (lambda (n) (lambda (x) (add x n))))"));
+    evalTopLevel(parse("(set addTen (makeAdder 10))"));
+    evalTopLevel(parse("(set curry3 (lambda (a) (lambda (b) (lambda (c) (sub (sub a b) c)))))"));
+    gcCollect();
+    fprintf(outFile, "Test 49 (closures capture their frame): %s\n",
+        numberOf(evalTopLevel(parse("(addTen 5)"))) == 15 &&
+        numberOf(evalTopLevel(parse("(((curry3 100) 20) 3)"))) == 77 &&
+        numberOf(execute(compile(parse("(addTen 32)")))) == 42 ? "pass" : "fail");
+
+    evalTopLevel(parse("(set fact (lambda (n) (if (< n 2) 1 (mul n (fact (sub n 1))))))"));
+    SExpr* factCall = compile(parse("(fact 10)"));
+    gcCollect();
+    fprintf(outFile, "Test 50 (recursive lambda): %s\n",
+        numberOf(evalTopLevel(parse("(fact 10)"))) == 3628800 &&
+        numberOf(execute(factCall)) == 3628800 ? "pass" : "fail");
+
+    // A million iterations would overflow the C stack without proper tail calls
+    evalTopLevel(parse("(set countDown (lambda (n acc) (if (< n 1) acc (countDown (sub n 1) (add acc 1)))))"));
+    SExpr* loop = parse("(countDown 1000000 0)");
+    size_t loopBefore = interp->heap.stats.bytesAllocated;
+    SExpr* loopResult = eval(loop);
+    fprintf(outFile, "Test 51 (tail-recursive loop in constant space): %s\n",
+        numberOf(loopResult) == 1000000 && interp->heap.stats.bytesAllocated - loopBefore <= 4 * sizeof(SExpr) &&
+        numberOf(evalTopLevel(loop)) == 1000000 ? "pass" : "fail");
+
+    evalTopLevel(parse("(set isEven (lambda (n) (if (eq n 0) t (isOdd (sub n 1)))))"));
+    evalTopLevel(parse("(set isOdd (lambda (n) (and (> n 0) (isEven (sub n 1)))))"));
+    evalTopLevel(parse("(set reachesZero (lambda (n) (or (eq n 0) (reachesZero (sub n 1)))))"));
+    fprintf(outFile, "Test 52 (mutual tail calls through if, and, or): %s\n",
+        evalTopLevel(parse("(isEven 1000000)")) == truth &&
+        evalTopLevel(parse("(isOdd 1000000)")) == nil &&
+        evalTopLevel(parse("(reachesZero 1000000)")) == truth ? "pass" : "fail");
+
+    // Variadic Arithmetic Tests
+    char* variadic[] = {
+        "(add 1 2 3 4 5)", "(sub 10)", "(sub 10 1 2)", "(mul 2 3 4)", "(div 100 5 2)", "(add)", "(mul)",
+        "(mul 3037000499 3037000499)", "(sub -9223372036854775807 1)"
+    };
+    long long expected[] = { 15, -10, 7, 24, 10, 0, 1, 9223372030926249001LL, LLONG_MIN };
+    int variadicOk = 1;
+    for (int i = 0; i < 9; i++) {
+        SExpr* expr = parse(variadic[i]);
+        SExpr* treeResult = eval(expr);
+        SExpr* vmResult = execute(compile(expr));
+        variadicOk &= typeOf(treeResult) == NUMBER && numberOf(treeResult) == expected[i] &&
+            typeOf(vmResult) == NUMBER && numberOf(vmResult) == expected[i];
+    }
+    fprintf(outFile, "Test 53 (variadic arithmetic in eval and bytecode): %s\n", variadicOk ? "pass" : "fail");
+
+    SExpr* overflow = eval(parse("(add 9223372036854775807 1)"));
+    SExpr* vmOverflow = execute(compile(parse("(mul 4611686018427387904 2 1)")));
+    fprintf(outFile, "Test 54 (overflow promotes instead of wrapping): %s\n",
+        typeOf(overflow) == BIGNUM && typeOf(vmOverflow) == BIGNUM && eq(overflow, vmOverflow) == truth &&
+        typeOf(eval(parse("(sub -9223372036854775808)"))) == BIGNUM &&
+        eval(parse("(div 5 0)")) == nil ? "pass" : "fail");
+
+    // Bignum Tests
+    evalTopLevel(parse("(set bigFact (lambda (n acc) (if (< n 2) acc (bigFact (sub n 1) (mul acc n)))))"));
+    SExpr* fact25 = evalTopLevel(parse("(bigFact 25 1)"));
+    char* fact25Text = bignumToString(fact25);
+    char* negativeText = bignumToString(parse("-340282366920938463463374607431768211456"));
+    SExpr* shrunk = eval(parse("(sub 15511210043330985984000000 15511210043330985983999999)"));
+    fprintf(outFile, "Test 55 (bignum factorial, reading and printing): %s\n",
+        strcmp(fact25Text, "15511210043330985984000000") == 0 &&
+        eq(fact25, parse("15511210043330985984000000")) == truth &&
+        isFixnum(shrunk) && numberOf(shrunk) == 1 &&
+        strcmp(negativeText, "-340282366920938463463374607431768211456") == 0 ? "pass" : "fail");
+    free(fact25Text);
+    free(negativeText);
+
+    // Karatsuba against schoolbook on operands well above the threshold
+    int limbs = KARATSUBA_THRESHOLD * 5 + 3, karatsubaOk = 1;
+    uint32_t* x = allocLimbs(limbs);
+    uint32_t* y = allocLimbs(limbs * 2);
+    uint32_t* fast = allocLimbs(limbs * 3);
+    uint32_t* slow = allocLimbs(limbs * 3);
+    uint32_t seed = 12345;
+    for (int i = 0; i < limbs * 2; i++) {
+        seed = seed * 1103515245u + 12345u;
+        if (i < limbs) x[i] = seed ^ (seed << 7);
+        y[i] = seed;
+    }
+    for (int ylimbs = limbs / 2; ylimbs <= limbs * 2; ylimbs += limbs / 2) {
+        magMul(fast, x, limbs, y, ylimbs);
+        magMulBasic(slow, x, limbs, y, ylimbs);
+        karatsubaOk &= memcmp(fast, slow, (limbs + ylimbs) * sizeof(uint32_t)) == 0;
+    }
+    free(x);
+    free(y);
+    free(fast);
+    free(slow);
+    fprintf(outFile, "Test 56 (karatsuba matches schoolbook): %s\n", karatsubaOk ? "pass" : "fail");
+
+    evalTopLevel(parse("(set fact300 (bigFact 300 1))"));
+    evalTopLevel(parse("(set fact200 (bigFact 200 1))"));
+    fprintf(outFile, "Test 57 (bignum division and comparisons): %s\n",
+        evalTopLevel(parse("(eq (div (mul fact300 fact200 7) fact200 7) fact300)")) == truth &&
+        evalTopLevel(parse("(eq (div (sub 0 fact300) fact200) (sub 0 (div fact300 fact200)))")) == truth &&
+        evalTopLevel(parse("(eq (div fact300 (div fact300 3)) 3)")) == truth &&
+        evalTopLevel(parse("(and (> fact300 fact200) (< (sub 0 fact300) 5))")) == truth &&
+        evalTopLevel(parse("(>= fact200 (add fact200 1))")) == nil &&
+        execute(compile(parse("(<= 5 fact200)"))) == truth &&
+        evalTopLevel(parse("(div fact300 0)")) == nil ? "pass" : "fail");
+
+    // Float and Vector Tests
+    char floatText[32], thirdText[32];
+    formatFloat(floatText, 3.0);
+    formatFloat(thirdText, 0.1);
+    SExpr* mixed = eval(parse("(add 1 2.5)"));
+    fprintf(outFile, "Test 58 (floats mix with integers): %s\n",
+        typeOf(mixed) == FLOAT && mixed->real == 3.5 &&
+        eval(parse("(div 1 4.0)"))->real == 0.25 && eval(parse("(mul 1.5 2 2)"))->real == 6.0 &&
+        eval(parse("(> 2.5 2)")) == truth && eval(parse("(eq 2 2.0)")) == truth &&
+        numberOf(eval(parse("(if 0.0 1 2)"))) == 2 && parse("-1.5e3")->real == -1500.0 &&
+        execute(compile(parse("(sub 100000000000000000000 0.5)")))->real == 1e20 &&
+        typeOf(parse("e5")) == SYMBOL && strcmp(floatText, "3.0") == 0 && strcmp(thirdText, "0.1") == 0 ? "pass" : "fail");
+
+    // Every kernel set the CPU supports must agree with the scalar loops
+    VectorKernels* available[3] = { &scalarKernels, NULL, NULL };
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    if (__builtin_cpu_supports("sse2")) available[1] = &sse2Kernels;
+    if (__builtin_cpu_supports("avx2")) available[2] = &avx2Kernels;
+#endif
+    double left[37], right[37], want[37], got[37];
+    int kernelsOk = 1;
+    for (int i = 0; i < 37; i++) {
+        left[i] = (i * 7) % 11 - 5;
+        right[i] = (i * 3) % 13 + 1;
+    }
+    for (int k = 1; k < 3; k++) {
+        if (!available[k]) continue;
+        for (size_t n = 1; n <= 37; n++) {
+            for (int op = OP_ADD; op <= OP_DIV; op++) {
+                scalarKernels.binary(op, want, left, right, n);
+                available[k]->binary(op, got, left, right, n);
+                kernelsOk &= memcmp(want, got, n * sizeof(double)) == 0;
+                scalarKernels.scalar(op, want, left, 4.0, n);
+                available[k]->scalar(op, got, left, 4.0, n);
+                kernelsOk &= memcmp(want, got, n * sizeof(double)) == 0;
+            }
+            kernelsOk &= available[k]->dot(left, right, n) == scalarKernels.dot(left, right, n) &&
+                available[k]->sum(left, n) == scalarKernels.sum(left, n) &&
+                available[k]->min(right, n) == scalarKernels.min(right, n) &&
+                available[k]->max(left, n) == scalarKernels.max(left, n);
+        }
+    }
+    fprintf(outFile, "Test 59 (SIMD kernels match scalar loops): %s\n", kernelsOk ? "pass" : "fail");
+
+    evalTopLevel(parse("(set scores (vector 1 2 3 4 5 6 7 8 9 10))"));
+    gcCollect();
+    SExpr* mismatch = evalTopLevel(parse("(vadd scores (vector 1 2))"));
+    fprintf(outFile, "Test 60 (vector builtins): %s\n",
+        evalTopLevel(parse("(vsum (vadd scores scores))"))->real == 110 &&
+        evalTopLevel(parse("(dot (vector 1 2 3) (vector 4 5 6))"))->real == 32 &&
+        evalTopLevel(parse("(vmax (vmap mul (vector 1 -2 3) 2))"))->real == 6 &&
+        evalTopLevel(parse("(vmin (vmap sub (vmul scores scores) 50))"))->real == -49 &&
+        evalTopLevel(parse("(vsum (vmap (lambda (x) (mul x x)) (vector 1 2 3)))"))->real == 14 &&
+        evalTopLevel(parse("(vmin (vector))")) == nil &&
+        typeOf(mismatch) == SYMBOL && strcmp(mismatch->symbol, "VECTOR: Length mismatch") == 0 ? "pass" : "fail");
+
+    // REPL Tests
+    FILE* replIn = tmpfile();
+    FILE* replOut = tmpfile();
+    fputs("(set replTotal\n  (add 1\n       2))\n) (set replLost 5)\n'(a . b) (mul replTotal\n 4)\n(add 1\n", replIn);
+    rewind(replIn);
+    runRepl(replIn, replOut, 1);
+    char transcript[512];
+    size_t transcriptLength = fread(transcript, 1, sizeof(transcript) - 1, (rewind(replOut), replOut));
+    transcript[transcriptLength] = '\0';
+    fclose(replIn);
+    fclose(replOut);
+    fprintf(outFile, "Test 61 (REPL reads multi-line forms and recovers from errors): %s\n",
+        strncmp(transcript, "3\n; ", 4) == 0 && strstr(transcript, "cells allocated\nREAD: Unexpected ')' on line 4\n(a . b)\n") &&
+        strstr(transcript, "\n12\n") && strstr(transcript, "READ: Unterminated list") &&
+        numberOf(get(makeSymbol("replTotal"))) == 3 && get(makeSymbol("replLost")) == nil &&
+        interp->scratchArena.allocated == 0 ? "pass" : "fail");
+
+    // Batch Runner Tests
+    FILE* batchScript = fopen("batch_test.lisp", "wb");
+    char batchExpected[8192];
+    size_t batchExpectedLength = 0;
+    int batchOk = batchScript != NULL;
+    if (batchScript) {
+        // Spans several batches: state, quoted data, floats and closures must survive each batch's release
+        fputs("(set batchCount 0) (set batchKept '(a 1.5 (b . c))) (set batchStep (lambda (n) (add n 1)))\n", batchScript);
+        batchExpectedLength += sprintf(batchExpected, "0\n(a 1.5 (b . c))\n#<lambda>\n");
+        for (int i = 1; i <= 600; i++) {
+            fprintf(batchScript, "(set batchCount (batchStep batchCount))\n");
+            batchExpectedLength += sprintf(batchExpected + batchExpectedLength, "%d\n", i);
+        }
+        fputs("batchKept 123456789012345678901234567890 (mul batchCount 2)\n(add 1", batchScript);
+        batchExpectedLength += sprintf(batchExpected + batchExpectedLength,
+            "(a 1.5 (b . c))\n123456789012345678901234567890\n1200\nREAD: Unterminated list on line 603\n");
+        fclose(batchScript);
+        for (int threaded = 0; threaded < 2 && batchOk; threaded++) {
+            FILE* output = tmpfile();
+            batchOk = output && runBatch("batch_test.lisp", output, threaded, 1);
+            char transcript[8192];
+            size_t transcriptLength = batchOk ? fread(transcript, 1, sizeof(transcript), (rewind(output), output)) : 0;
+            batchOk = batchOk && transcriptLength == batchExpectedLength && memcmp(transcript, batchExpected, batchExpectedLength) == 0;
+            if (output) fclose(output);
+        }
+        remove("batch_test.lisp");
+    }
+    fprintf(outFile, "Test 62 (batch runner pipelines read, eval and print): %s\n",
+        batchOk && numberOf(get(makeSymbol("batchCount"))) == 600 && !runBatch("batch_missing.lisp", stdout, 1, 1) ? "pass" : "fail");
+
+    // Printer Tests
+    SExpr* deep = makeNumber(7);
+    for (int i = 0; i < 200000; i++) deep = cons(deep, nil);
+    char* deepText = sprintSExpr(deep);
+    int printOk = strlen(deepText) == 400001 && deepText[199999] == '(' && deepText[200000] == '7' && deepText[200001] == ')';
+    free(deepText);
+    SExpr* extremes = cons(makeNumber(LLONG_MIN), cons(makeNumber(-1), cons(makeNumber(0), cons(makeNumber(99),
+        cons(makeNumber(100), cons(makeNumber(12345678901LL), cons(makeNumber(LLONG_MAX), nil)))))));
+    char* extremesText = sprintSExpr(extremes);
+    printOk = printOk && strcmp(extremesText, "(-9223372036854775808 -1 0 99 100 12345678901 9223372036854775807)") == 0;
+    free(extremesText);
+    char* dottedText = sprintSExpr(parse("(a (b . c) ((1 . 2)) . d)"));
+    printOk = printOk && strcmp(dottedText, "(a (b . c) ((1 . 2)) . d)") == 0;
+    free(dottedText);
+
+    // Past the output chunk size, including one atom larger than a whole chunk
+    char* longName = malloc(PRINT_CHUNK + 100);
+    memset(longName, 'z', PRINT_CHUNK + 100);
+    SExpr* wide = cons(makeSymbolSpan(longName, PRINT_CHUNK + 100), nil);
+    free(longName);
+    for (int i = 0; i < 50000; i++) wide = cons(makeNumber(i * 7919LL), wide);
+    char* wideText = sprintSExpr(wide);
+    size_t wideLength = strlen(wideText);
+    for (int viaFd = 0; viaFd < 2 && printOk; viaFd++) {
+        FILE* printed = tmpfile();
+        if (!printed) {
+            printOk = 0;
+            break;
+        }
+        if (viaFd) writeSExprFd(fileno(printed), wide);
+        else writeSExpr(printed, wide);
+        fflush(printed);
+        rewind(printed);
+        char* readBack = malloc(wideLength + 1);
+        printOk = readBack && fread(readBack, 1, wideLength + 1, printed) == wideLength && memcmp(readBack, wideText, wideLength) == 0;
+        free(readBack);
+        fclose(printed);
+    }
+    free(wideText);
+    fprintf(outFile, "Test 63 (buffered printer handles deep nesting and large output): %s\n", printOk ? "pass" : "fail");
+
+    // Parallel Evaluation Tests
+    FILE* parallelScript = fopen("parallel_test.lisp", "wb");
+    int parallelOk = parallelScript != NULL;
+    if (parallelScript) {
+        // parFib is pure; parBump sets a global from inside a closure, which no syntactic check sees
+        fputs("(set parFib (lambda (n) (if (< n 2) n (add (parFib (sub n 1)) (parFib (sub n 2))))))\n"
+            "(set parBump (lambda (n) (set parCounter n)))\n(set parCounter 0)\n", parallelScript);
+        for (int i = 0; i < 600; i++) {
+            if (i == 150 || i == 400) fprintf(parallelScript, "(parBump %d)\n", i);
+            else if (i % 50 == 7) fprintf(parallelScript, "'(a 1.5 (b . c))\n");
+            else if (i % 50 == 9) fprintf(parallelScript, "(mul 99999999999 99999999999 %d)\n", i);
+            else fprintf(parallelScript, "(add (parFib %d) parCounter)\n", i % 18);
+        }
+        fclose(parallelScript);
+        char* transcripts[2] = { NULL, NULL };
+        for (int k = 0; k < 2 && parallelOk; k++) {
+            FILE* output = tmpfile();
+            parallelOk = output && runBatch("parallel_test.lisp", output, 1, k ? 4 : 1);
+            long size = parallelOk ? (fseek(output, 0, SEEK_END), ftell(output)) : 0;
+            transcripts[k] = calloc(size + 1, 1);
+            parallelOk = parallelOk && transcripts[k] && fread(transcripts[k], 1, size, (rewind(output), output)) == (size_t)size;
+            if (output) fclose(output);
+        }
+        // Form 151 is parFib 7 after the first bump, form 401 parFib 5 after the second
+        parallelOk = parallelOk && strcmp(transcripts[0], transcripts[1]) == 0 &&
+            strstr(transcripts[1], "\n150\n163\n") && strstr(transcripts[1], "\n400\n405\n");
+        free(transcripts[0]);
+        free(transcripts[1]);
+        remove("parallel_test.lisp");
+    }
+    fprintf(outFile, "Test 64 (parallel evaluation matches serial results in order): %s\n",
+        parallelOk && numberOf(get(makeSymbol("parCounter"))) == 400 && interp->heap.inhibit == 0 ? "pass" : "fail");
+
+    // Embedding Tests
+    Interp* first = lispCreate(__builtin_frame_address(0));
+    Interp* second = lispCreate(__builtin_frame_address(0));
+    lispEval(first, "(set shared 1) (set tenfold (lambda (x) (mul x 10)))");
+    lispEval(second, "(set shared 2)");
+    lispSet(second, "fromHost", makeNumber(5));
+    int embedOk = numberOf(lispEval(first, "(tenfold shared)")) == 10 && lispEval(second, "(tenfold shared)") == nil &&
+        numberOf(lispGet(second, "shared")) == 2 && lispGet(first, "fromHost") == nil &&
+        numberOf(lispEval(second, "(add fromHost 1)")) == 6 && get(makeSymbol("shared")) == nil &&
+        lispError(second) == NULL;
+    lispEval(first, "(add 1 2) (add 1");
+    embedOk = embedOk && lispError(first) && strcmp(lispError(first), "READ: Unterminated list") == 0 &&
+        lispEval(first, "shared") && lispError(first) == NULL;
+    lispDestroy(first);
+    lispDestroy(second);
+    int sessionOk[4] = { 0, 0, 0, 0 };
+#ifdef LISP_THREADS
+    pthread_t sessions[4];
+    int started[4];
+    for (int i = 0; i < 4; i++) started[i] = pthread_create(&sessions[i], NULL, embedSession, &sessionOk[i]) == 0;
+    for (int i = 0; i < 4; i++) {
+        if (started[i]) pthread_join(sessions[i], NULL);
+    }
+#else
+    for (int i = 0; i < 4; i++) embedSession(&sessionOk[i]);
+#endif
+    fprintf(outFile, "Test 65 (independent interpreter instances on separate threads): %s\n",
+        embedOk && sessionOk[0] && sessionOk[1] && sessionOk[2] && sessionOk[3] && interp == &defaultInterp ? "pass" : "fail");
+
+    int envOk = 1;
+#ifdef LISP_THREADS
+    // Readers racing a writer that updates every binding and adds enough new ones to grow the table several times
+    EnvTraffic traffic = { interp, makeNames("envShared", 1000), 1000, makeNames("envAdded", 6000), 6000, 6, 0, 0, 0, 0 };
+    for (int i = 0; i < traffic.count; i++) set(traffic.names[i], makeNumber(i));
+    long long envLookups = runEnvTraffic(&traffic, 3);
+    for (int i = 0; i < traffic.addedCount && envOk; i++) envOk = numberOf(get(traffic.added[i])) == i;
+    envOk = envOk && envLookups >= 0 && numberOf(get(traffic.names[7])) == 7 + 6 * 1000;
+    free(traffic.names);
+    free(traffic.added);
+#endif
+    fprintf(outFile, "Test 66 (concurrent readers see consistent globals while a writer updates them): %s\n", envOk ? "pass" : "fail");
+
+    // Benchmark harness: one macro benchmark reported as JSON and as CSV
+    char report[4096];
+    int benchOk = 1;
+    for (int format = BENCH_JSON; format <= BENCH_CSV; format++) {
+        FILE* reportFile = tmpfile();
+        if (!reportFile) {
+            benchOk = 0;
+            break;
+        }
+        runBenchmarks(reportFile, format, 3, "fib");
+        rewind(reportFile);
+        size_t reportLength = fread(report, 1, sizeof(report) - 1, reportFile);
+        report[reportLength] = '\0';
+        fclose(reportFile);
+        if (format == BENCH_JSON) {
+            benchOk = benchOk && strstr(report, "\"name\": \"fib\"") && strstr(report, "\"reps\": 3") &&
+                strstr(report, "\"median_ns_per_op\"") && strstr(report, "\"p99_ns_per_op\"") && !strstr(report, "tak");
+        } else {
+            benchOk = benchOk && strncmp(report, "name,group,ops_per_rep,reps,median_ns", 37) == 0 && strstr(report, "\nfib,macro,1,3,");
+        }
+    }
+    fprintf(outFile, "Test 67 (benchmark harness reports JSON and CSV): %s\n", benchOk ? "pass" : "fail");
+
+#ifdef LISP_PROFILE
+    // Profile report: synthetic samples, summed, sorted by total time and bucketed by log2 ns
+    profileReset();
+    for (int i = 0; i < 3; i++) profileRecord(OP_ADD, 100, 2);
+    profileRecord(OP_IF, 5000, 0);
+    int profileOk = 1;
+    for (int json = 0; json < 2; json++) {
+        FILE* reportFile = tmpfile();
+        if (!reportFile) {
+            profileOk = 0;
+            break;
+        }
+        writeProfile(reportFile, json);
+        rewind(reportFile);
+        size_t reportLength = fread(report, 1, sizeof(report) - 1, reportFile);
+        report[reportLength] = '\0';
+        fclose(reportFile);
+        char* ifRow = strstr(report, json ? "\"name\": \"if\"" : "\nif ");
+        char* addRow = strstr(report, json ? "\"name\": \"add\", \"calls\": 3, \"total_ns\": 300" : "\nadd ");
+        profileOk = profileOk && ifRow && addRow && ifRow < addRow && !strstr(report, "closure call");
+        if (json) profileOk = profileOk && strstr(report, "\"p50_ns\": 128, \"p99_ns\": 128, \"cells\": 6");
+    }
+    profileReset();
+    fprintf(outFile, "Test 68 (profile report sums, sorts and buckets samples): %s\n", profileOk ? "pass" : "fail");
+#endif
+
+#ifdef LISP_SAMPLING
+    // Sampling profiler: a named recursive function shows up as nested frames in the folded output
+    evalTopLevel(parse("(set sampledFib (lambda (n) (if (< n 2) n (add (sampledFib (sub n 1)) (sampledFib (sub n 2))))))"));
+    int sampleOk = startSampling(10000);
+    long long sampleDeadline = nowNanos() + 5000000000LL;
+    while (sampleOk && atomic_load(&sampler.used) < 200 && nowNanos() < sampleDeadline) evalTopLevel(parse("(sampledFib 18)"));
+    stopSampling();
+    FILE* foldedFile = tmpfile();
+    long sampleCount = foldedFile && sampleOk ? writeFoldedStacks(foldedFile) : 0;
+    size_t foldedLength = 0;
+    if (foldedFile) {
+        rewind(foldedFile);
+        foldedLength = fread(report, 1, sizeof(report) - 1, foldedFile);
+        fclose(foldedFile);
+    }
+    report[foldedLength] = '\0';
+    sampleOk = sampleOk && sampleCount > 0 && strstr(report, "sampledFib;sampledFib;sampledFib") &&
+        report[foldedLength - 1] == '\n';
+    fprintf(outFile, "Test 69 (sampling profiler folds Lisp call stacks): %s\n", sampleOk ? "pass" : "fail");
+#endif
+
+    // Inline Cache Tests: misses go stale when set adds a name, hits survive table growth
+    evalTopLevel(parse("(set readLater (lambda () cacheTarget))"));
+    SExpr* laterCode = compile(parse("cacheTarget"));
+    int cacheOk = evalTopLevel(parse("(readLater)")) == nil && execute(laterCode) == nil &&
+        evalTopLevel(parse("(readLater)")) == nil;
+    evalTopLevel(parse("(set cacheTarget 5)"));
+    cacheOk = cacheOk && numberOf(evalTopLevel(parse("(readLater)"))) == 5 && numberOf(execute(laterCode)) == 5;
+    SExpr** cacheNames = makeNames("cacheFiller", 300);
+    for (int i = 0; i < 300; i++) set(cacheNames[i], makeNumber(i));
+    free(cacheNames);
+    evalTopLevel(parse("(set cacheTarget 6)"));
+    SExpr* reference = get(makeSymbol("readLater"))->body;
+    fprintf(outFile, "Test 70 (global references cache their binding): %s\n",
+        cacheOk && numberOf(evalTopLevel(parse("(readLater)"))) == 6 && numberOf(execute(laterCode)) == 6 &&
+        typeOf(reference) == GLOBAL && LOAD_ACQUIRE(reference->global.binding) == lookupBinding(makeSymbol("cacheTarget")) &&
+        numberOf(evalTopLevel(parse("(fact 10)"))) == 3628800 ? "pass" : "fail");
+
+    // Optimizer Tests
+    char* foldable[] = {
+        "(add 2 3)", "(if t 'a 'b)", "(if (> 1 2) 1 (mul 2 3))", "(and t (sub 9 2))", "(and 0 x)", "(or nil 4)",
+        "(or 'k unbound)", "(eq 'a 'a)", "(cond (t . 7))", "(cond ((eq 1 2) . ((t . 8))))", "(div 1 0)",
+        "(add (mul 99999999999 99999999999) 1)", "(add 1.5 (div 10 4))", "(<= (sub 3) 2)",
+    };
+    size_t eliminated = 0;
+    int optimizeOk = 1;
+    for (size_t i = 0; i < sizeof(foldable) / sizeof(foldable[0]); i++) {
+        SExpr* program = parse(foldable[i]);
+        SExpr* optimized = optimize(program, &eliminated);
+        SExpr* expected = eval(program);
+        SExpr* actual = eval(optimized);
+        if (optimized == program || (typeOf(optimized) == CONS && typeOf(optimized->car) == SYMBOL &&
+                optimized->car->opcode != OP_QUOTE)) optimizeOk = 0;
+        if (typeOf(expected) != typeOf(actual) || (isNumber(expected) ? compareNumbers(expected, actual) != 0 :
+                typeOf(expected) != CONS && expected != actual)) optimizeOk = 0;
+    }
+    size_t partial = 0;
+    SExpr* unfoldable = parse("(add 1 'a)");
+    SExpr* shadowed = parse("(lambda (add) (add 1 2))");
+    SExpr* scaled = optimize(parse("(set optScale (lambda (x) (if (> x (add 1 1)) (mul x (add 2 3)) (and x 0))))"), &partial);
+    evalTopLevel(scaled);
+    fprintf(outFile, "Test 71 (optimizer folds constants and prunes branches): %s\n",
+        optimizeOk && eliminated > 40 && optimize(unfoldable, NULL) == unfoldable && optimize(shadowed, NULL) == shadowed &&
+        partial == 10 && numberOf(evalTopLevel(parse("(optScale 7)"))) == 35 &&
+        numberOf(evalTopLevel(parse("(optScale 1)"))) == 0 ? "pass" : "fail");
+
+    // Hash-consing Tests
+    int sharedEq = evalTopLevel(parse("(eq '(a 1) '(a 1))")) == nil;
+    interp->hashCons = 1;
+    evalTopLevel(parse("(set shareA '(rule (> x 10) (add 2.5 99999999999999999999 -4611686018427387905)))"));
+    evalTopLevel(parse("(set shareB '(rule (> x 10) (add 2.5 99999999999999999999 -4611686018427387905)))"));
+    evalTopLevel(parse("(set shareC '(other (> x 10)))"));
+    SExpr* shareA = get(makeSymbol("shareA"));
+    SExpr* shareB = get(makeSymbol("shareB"));
+    SExpr* shareC = get(makeSymbol("shareC"));
+    sharedEq = sharedEq && shareA == shareB && shareA->cdr->car == shareC->cdr->car &&
+        evalTopLevel(parse("(eq shareA shareB)")) == truth && evalTopLevel(parse("(eq '(a 1) '(a 1))")) == truth &&
+        evalTopLevel(parse("(eq '(a 1) '(a 2))")) == nil && numberOf(evalTopLevel(parse("(add 1 2)"))) == 3;
+    size_t sharedBefore = interp->shared.count;
+    char sharedText[64];
+    for (int i = 0; i < 1000; i++) {
+        sprintf(sharedText, "'(garbage %d (%d 2.5))", i + 1000000, i);
+        evalTopLevel(parse(sharedText));
+    }
+    size_t sharedPeak = interp->shared.count;
+    gcCollect();
+    interp->hashCons = 0;
+    fprintf(outFile, "Test 72 (hash-consing shares equal subtrees weakly): %s\n",
+        sharedEq && sharedPeak >= sharedBefore + 4000 && interp->shared.count < sharedBefore + 100 &&
+        get(makeSymbol("shareA")) == shareA && shareA->cdr->cdr->car->cdr->cdr->car->type == BIGNUM ? "pass" : "fail");
+
+    // Arity Tests: short and long forms are errors in eval and the VM, never a crash
+    char* misshapen[] = { "(eq 1)", "(eq)", "(> 1)", "(<= 1 2 3)", "(and t)", "(or nil)", "(and t t t)", "(if nil 1)", "(if t)" };
+    int arityOk = 1;
+    for (size_t i = 0; i < sizeof(misshapen) / sizeof(misshapen[0]); i++) {
+        SExpr* form = parse(misshapen[i]);
+        interp->error = NULL;
+        SExpr* evaluated = eval(form);
+        char* evalError = interp->error;
+        interp->error = NULL;
+        SExpr* executed = execute(compile(form));
+        if (!evalError || evaluated->symbol != evalError || !interp->error || executed->symbol != interp->error) arityOk = 0;
+    }
+    interp->error = NULL;
+    fprintf(outFile, "Test 73 (special forms check their argument count): %s\n", arityOk ? "pass" : "fail");
+
+    // A malformed form is reported and the session carries on
+    FILE* arityIn = tmpfile();
+    FILE* arityOut = tmpfile();
+    fputs("(set replAfter 1)\n(> 1)\n(eq 1) (and t)\n(set replAfter (add replAfter 1))\nreplAfter\n", arityIn);
+    rewind(arityIn);
+    runRepl(arityIn, arityOut, 0);
+    char arityTranscript[256];
+    size_t arityLength = fread(arityTranscript, 1, sizeof(arityTranscript) - 1, (rewind(arityOut), arityOut));
+    arityTranscript[arityLength] = '\0';
+    fclose(arityIn);
+    fclose(arityOut);
+    interp->error = NULL;
+    fprintf(outFile, "Test 74 (REPL reports malformed forms and keeps going): %s\n",
+        strcmp(arityTranscript, "1\nCOMPARE: Expected two arguments\nEQ: Expected two arguments\n"
+            "AND: Expected two arguments\n2\n2\n") == 0 ? "pass" : "fail");
+
+    // The batch runner reports a malformed form and evaluates the rest, serially and in parallel
+    FILE* arityScript = fopen("batch_arity.lisp", "wb");
+    int batchArityOk = arityScript != NULL;
+    if (arityScript) {
+        fputs("(set batchAfter 1)\n(> 1)\n(eq 1)\n(add batchAfter 1)\n(if (eq 2 2) 'yes)\n(eq 2 2)\n", arityScript);
+        fclose(arityScript);
+        const char* expected = "1\nCOMPARE: Expected two arguments\nEQ: Expected two arguments\n2\n"
+            "IF: Expected a condition and two branches\nt\n";
+        for (int run = 0; run < 3 && batchArityOk; run++) {
+            FILE* output = tmpfile();
+            batchArityOk = output && runBatch("batch_arity.lisp", output, run > 0, run == 2 ? 4 : 1);
+            char transcript[256];
+            size_t length = batchArityOk ? fread(transcript, 1, sizeof(transcript) - 1, (rewind(output), output)) : 0;
+            transcript[length] = '\0';
+            batchArityOk = batchArityOk && strcmp(transcript, expected) == 0;
+            if (output) fclose(output);
+        }
+        remove("batch_arity.lisp");
+    }
+    interp->error = NULL;
+    fprintf(outFile, "Test 75 (batch runner reports malformed forms and carries on): %s\n", batchArityOk ? "pass" : "fail");
+
+    // Operand Tests: arithmetic and comparisons reject non-numbers in eval, the VM and the optimizer
+    char* mistyped[] = { "(add 'a 1)", "(add 1 'a)", "(sub 'a)", "(mul 99999999999999999999 'a)",
+        "(div 1.5 nil)", "(add 1 2 '(3))", "(> 'a 1)", "(<= 1 t)" };
+    int operandsOk = 1;
+    for (size_t i = 0; i < sizeof(mistyped) / sizeof(mistyped[0]); i++) {
+        SExpr* form = parse(mistyped[i]);
+        char* expected = i < 6 ? "ARITH: Operands must be numbers" : "COMPARE: Operands must be numbers";
+        interp->error = NULL;
+        SExpr* evaluated = eval(form);
+        if (!interp->error || strcmp(interp->error, expected) != 0 || evaluated->symbol != interp->error) operandsOk = 0;
+        interp->error = NULL;
+        SExpr* executed = execute(compile(form));
+        if (!interp->error || strcmp(interp->error, expected) != 0 || executed->symbol != interp->error) operandsOk = 0;
+        if (optimize(form, NULL) != form) operandsOk = 0;
+    }
+    interp->error = NULL;
+    fprintf(outFile, "Test 76 (arithmetic and comparisons reject non-numbers): %s\n",
+        operandsOk && typeOf(evalTopLevel(parse("(add 1 2.5 99999999999999999999)"))) == FLOAT ? "pass" : "fail");
+
 
     fclose(outFile); // Close the file
 }
@@ -606,8 +5884,65 @@ void runTests() {
 //         eval(cons(makeSymbol("lambda"), cons(cons(makeSymbol("x"), nil), cons(makeNumber(5), nil))))->type == LAMBDA ? "pass" : "fail");
 // }
 
-int main() {
-    initNil();
-    runTests();
-    return 0;
+int main(int argc, char** argv) {
+    initGC(__builtin_frame_address(0));
+    initSymbols();
+#ifdef LISP_PROFILE
+    atexit(writeProfileAtExit);
+#endif
+    int bench = 0, repl = 0, stats = 0, run = 0, jobs = 1, format = BENCH_TEXT, reps = 11;
+    char* script = NULL;
+    char* filter = NULL;
+    char* samplePath = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--bench") == 0) bench = 1;
+        else if (strcmp(argv[i], "--repl") == 0) repl = 1;
+        else if (strcmp(argv[i], "--stats") == 0) repl = stats = 1;
+        else if (strcmp(argv[i], "--run") == 0) {
+            run = 1;
+            if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) script = argv[++i];
+        }
+        else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) jobs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            i++;
+            format = strcmp(argv[i], "json") == 0 ? BENCH_JSON : strcmp(argv[i], "csv") == 0 ? BENCH_CSV : BENCH_TEXT;
+        }
+        else if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc) reps = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) filter = argv[++i];
+        else if (strcmp(argv[i], "--sample") == 0 && i + 1 < argc) samplePath = argv[++i];
+        else if (strcmp(argv[i], "--optimize") == 0) interp->optimize = 1;
+        else if (strcmp(argv[i], "--hashcons") == 0) interp->hashCons = 1;
+    }
+    FILE* samples = NULL;
+    if (samplePath) {
+#ifdef LISP_SAMPLING
+        samples = fopen(samplePath, "w");
+        if (!samples || !startSampling(SAMPLE_HZ)) {
+            fprintf(stderr, "Error: Cannot sample to %s\n", samplePath);
+            return 1;
+        }
+#else
+        fprintf(stderr, "Error: Sampling needs POSIX signals\n");
+        return 1;
+#endif
+    }
+    int status = 0;
+    if (bench) runBenchmarks(stdout, format, reps, filter);
+    else if (run) {
+        if (!runBatch(script, stdout, 1, jobs)) {
+            fprintf(stderr, "Error: Cannot open %s\n", script);
+            status = 1;
+        }
+    }
+    else if (repl) runRepl(stdin, stdout, stats);
+    else runTests();
+    if (interp->optimize && (run || repl)) fprintf(stderr, "optimizer: %zu nodes eliminated\n", interp->nodesEliminated);
+#ifdef LISP_SAMPLING
+    if (samples) {
+        stopSampling();
+        writeFoldedStacks(samples);
+        fclose(samples);
+    }
+#endif
+    return status;
 }